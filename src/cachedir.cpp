@@ -0,0 +1,155 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+/*
+ * Private cache directory: cached state (e.g. the delay calibration) is
+ * trusted when loaded, so it is kept in a directory only the current user
+ * can access. CACHE_DIR is created 0700 if missing, and is not used at all
+ * (nothing is cached) if it is not a real directory owned by the current
+ * user, or if group or others have any access to it. Files are opened
+ * without following symlinks and written to a new temporary file that is
+ * then renamed in place.
+ */
+#define CACHE_DIR	"/var/cache/picberry"
+
+enum {CACHE_UNCHECKED, CACHE_OK, CACHE_UNUSABLE};
+static int cache_state = CACHE_UNCHECKED;
+
+static bool cache_dir_check(void)
+{
+	struct stat st;
+
+	if (cache_state != CACHE_UNCHECKED)
+		return cache_state == CACHE_OK;
+
+	cache_state = CACHE_UNUSABLE;
+	if (mkdir(CACHE_DIR, 0700) == -1 && errno != EEXIST)
+		return false;
+	if (lstat(CACHE_DIR, &st) == -1)
+		return false;
+	if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+			(st.st_mode & 077)) {
+		fprintf(stderr, "%s is not a private directory of this user, "
+				"not caching\n", CACHE_DIR);
+		return false;
+	}
+
+	cache_state = CACHE_OK;
+	return true;
+}
+
+/* Path of the cache file name (or of the directory if name is NULL) */
+bool cache_path(const char *name, char *path, size_t len)
+{
+	int n;
+
+	if (!cache_dir_check())
+		return false;
+	if (name)
+		n = snprintf(path, len, "%s/%s", CACHE_DIR, name);
+	else
+		n = snprintf(path, len, "%s", CACHE_DIR);
+	return n > 0 && (size_t)n < len;
+}
+
+/* Open a cache file for reading, -1 if missing or not a regular file */
+int cache_open(const char *name)
+{
+	char path[256];
+	struct stat st;
+	int fd;
+
+	if (!cache_path(name, path, sizeof(path)))
+		return -1;
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+			st.st_uid != geteuid()) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+FILE *cache_fopen(const char *name)
+{
+	FILE *fp;
+	int fd;
+
+	fd = cache_open(name);
+	if (fd == -1)
+		return NULL;
+	fp = fdopen(fd, "r");
+	if (fp == NULL)
+		close(fd);
+	return fp;
+}
+
+/*
+ * Create a new temporary file for the cache file name, to be passed to
+ * cache_commit() once written. tmp receives its path.
+ */
+FILE *cache_create(const char *name, char *tmp, size_t len)
+{
+	char path[256];
+	FILE *fp;
+	int fd;
+
+	if (!cache_path(name, path, sizeof(path)))
+		return NULL;
+	if ((size_t)snprintf(tmp, len, "%s.XXXXXX", path) >= len)
+		return NULL;
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		return NULL;
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmp);
+	}
+	return fp;
+}
+
+/* Close the temporary file and move it in place of the cache file name */
+bool cache_commit(FILE *fp, const char *tmp, const char *name, bool ok)
+{
+	char path[256];
+
+	if (fflush(fp) != 0 || ferror(fp))
+		ok = false;
+	if (fclose(fp) != 0)
+		ok = false;
+	if (ok && cache_path(name, path, sizeof(path)) &&
+			rename(tmp, path) == 0)
+		return true;
+	unlink(tmp);
+	return false;
+}
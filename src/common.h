@@ -21,15 +21,11 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
-#if defined(BOARD_A10)
-#include "hosts/a10.h"
-#elif defined(BOARD_RPI)
-#include "hosts/rpi.h"
-#elif defined(BOARD_RPI2)
-#include "hosts/rpi2.h"
-#elif defined(BOARD_AM335X)
-#include "hosts/am335x.h"
-#endif
+#include <stdio.h>
+#include <time.h>
+
+#include "gpio.h"
+#include "inhx.h"
 
 #include "devices/device.h"
 
@@ -38,13 +34,66 @@ using namespace std;
 #define VERSION "0.2"
 
 /* Low-level functions */
-void delay_us(unsigned int howLong);
 void setup_io(void);
 void close_io(void);
 
+/* cachedir.cpp functions */
+bool cache_path(const char *name, char *path, size_t len);
+int cache_open(const char *name);
+FILE *cache_fopen(const char *name);
+FILE *cache_create(const char *name, char *tmp, size_t len);
+bool cache_commit(FILE *fp, const char *tmp, const char *name, bool ok);
+
+/* delay.cpp functions */
+void delay_init(void);
+void delay_us(unsigned int howLong);
+void delay_ns(unsigned int howLong);
+void delay_bit_us(unsigned int howLong);
+void delay_bit_ns(unsigned int howLong);
+uint64_t delay_now_ns(void);
+void delay_set_sleep_threshold(unsigned int us);
+void delay_set_scale(unsigned int percent);
+void delay_stats_reset(void);
+void delay_stats_report(void);
+void delay_jitter_enable(bool enable);
+
+/* realtime.cpp functions */
+void realtime_enter(int cpu);
+void realtime_worker(void);
+
+/* gang.cpp functions */
+bool gang_parse(const char *list, gpio_pin &data);
+void gang_resolve(gpio_pin &data);
+int gang_targets(void);
+void gang_expect(uint32_t addr, uint32_t value, uint32_t mask);
+void gang_expect_block(memory &mem, uint32_t addr, bool blank = false);
+void gang_reset(void);
+unsigned long gang_failures(int t, unsigned long &words, uint32_t &first);
+void gang_report(void);
+
+/* link.cpp functions */
+void link_train(Pic *pic, const char *family);
+
 /* inhx.cpp functions */
 unsigned int read_inhx(char *infile, memory *mem, uint32_t offset=0);
 void write_inhx(memory *mem, char *outfile, uint32_t offset=0);
+extern unsigned int inhx_record_size;
+extern int inhx_overlap;
+
+#define INHX_OVERLAP_ERROR	0	// refuse different data for the same word
+#define INHX_OVERLAP_FIRST	1	// keep the data of the first file
+#define INHX_OVERLAP_LAST	2	// keep the data of the last file
+
+/* elf.cpp functions */
+bool is_elf(const void *buf, size_t size);
+unsigned int read_elf(const void *buf, size_t size, memory *mem,
+		uint32_t offset);
+
+/* image_cache.cpp functions */
+bool image_cache_load(const void *buf, size_t size, time_t mtime,
+		memory *mem, uint32_t offset, unsigned int &filled_locations);
+void image_cache_store(const void *buf, size_t size, time_t mtime,
+		memory *mem, uint32_t offset, unsigned int filled_locations);
 
 /* Runtime Functions */
 void pic_reset(bool silent = false);
@@ -55,8 +104,7 @@ void server_mode(int port);
 uint8_t send_file(char * filename);
 uint8_t receive_file(int sock, char * filename);
 
-extern volatile uint32_t *gpio;
-extern int pic_clk, pic_data, pic_mclr;
+extern gpio_pin pic_clk, pic_data, pic_mclr;
 
 struct flags_struct {
    int debug = 0;
@@ -66,6 +114,11 @@ struct flags_struct {
    int program_only = 0;
    int eeprom_only = 0;
    int fulldump = 0;
+   int train = 0;
+   int no_image_cache = 0;
+   int verify_region = 0x10000;
+   int incremental = 0;
+   int pe_4phase = 0;
 };
 
 extern struct flags_struct flags;
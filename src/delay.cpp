@@ -0,0 +1,391 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <iostream>
+
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Delays shorter than a couple of clock reads are done by spinning an empty
+ * loop for a calibrated number of iterations; longer ones spin on
+ * CLOCK_MONOTONIC_RAW until the deadline. The cycle counter is not used as
+ * it is not readable from user space on most ARM kernels.
+ *
+ * Calibration is cached in DELAY_CALFILE (in the private cache directory)
+ * together with the kernel boot id, so it is redone once after every reboot
+ * (CPU clock or kernel may change). A cached calibration is only used if a
+ * short spin with it takes about as long as it should.
+ *
+ * Waits longer than the sleep threshold (erase and programming times) sleep
+ * with clock_nanosleep() up to DELAY_SPIN_MARGIN before an absolute deadline
+ * and spin only for the rest, so they do not keep a core busy.
+ *
+ * In real-time mode the time spent between consecutive delays (i.e. in the
+ * GPIO accesses of a bit, plus any preemption) is recorded, so that the
+ * worst gap between edges can be reported with the other statistics.
+ */
+#define DELAY_CLOCK		CLOCK_MONOTONIC_RAW
+#define DELAY_SLEEP_CLOCK	CLOCK_MONOTONIC
+#define DELAY_CALFILE	"delay.cal"
+#define DELAY_BOOTID	"/proc/sys/kernel/random/boot_id"
+#define DELAY_SLEEP_THRESHOLD	1000	// us
+#define DELAY_SPIN_MARGIN		50000	// ns
+
+struct delay_calibration {
+	uint32_t clock_ns;		// cost of a single clock read
+	uint32_t loops_per_us;	// spin loop iterations per microsecond
+};
+
+static struct delay_calibration cal = {0, 0};
+
+static uint64_t sleep_threshold_ns = DELAY_SLEEP_THRESHOLD*1000ULL;
+
+/* bit timing scale in percent of nominal, see delay_bit_ns() */
+static unsigned int scale = 100;
+
+/* edge gap histogram buckets: < 1us, < 10us, < 100us, < 1ms, >= 1ms */
+#define JITTER_BUCKETS	5
+
+/* statistics for the current operation, see delay_stats_report() */
+static struct {
+	uint64_t start_ns;
+	uint64_t slept_ns;
+	uint64_t cpu_start_us;
+} stats;
+
+static struct {
+	bool enabled;
+	uint64_t last_ns;		// end of the previous delay, 0 if none
+	uint64_t worst_ns;
+	unsigned long count;
+	unsigned long histogram[JITTER_BUCKETS];
+} jitter;
+
+uint64_t delay_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(DELAY_CLOCK, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static inline void spin_loops(uint32_t loops)
+{
+	while (loops--)
+		__asm__ __volatile__("" ::: "memory");
+}
+
+static inline uint64_t sleep_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(DELAY_SLEEP_CLOCK, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/* Sleep until shortly before the deadline, then spin until it expires */
+static void sleep_spin(uint64_t howLong)
+{
+	struct timespec wake;
+	uint64_t tStart, tEnd, tWake;
+
+	tStart = sleep_clock_ns();
+	tEnd = tStart + howLong;
+	tWake = tEnd - DELAY_SPIN_MARGIN;
+
+	wake.tv_sec = tWake / 1000000000ULL;
+	wake.tv_nsec = tWake % 1000000000ULL;
+	while (clock_nanosleep(DELAY_SLEEP_CLOCK, TIMER_ABSTIME, &wake, NULL) == EINTR)
+		;
+	stats.slept_ns += sleep_clock_ns() - tStart;
+
+	while (sleep_clock_ns() < tEnd)
+		;
+}
+
+static inline void wait_ns(unsigned int howLong)
+{
+	uint64_t tEnd;
+
+	if (sleep_threshold_ns && howLong >= sleep_threshold_ns) {
+		sleep_spin(howLong);
+		return;
+	}
+
+	if (howLong < 2*cal.clock_ns) {
+		spin_loops(((uint64_t)howLong*cal.loops_per_us + 999)/1000);
+		return;
+	}
+
+	tEnd = delay_now_ns() + howLong;
+	while (delay_now_ns() < tEnd)
+		;
+}
+
+static void record_gap(uint64_t now)
+{
+	uint64_t gap, limit = 1000;
+	int b;
+
+	if (jitter.last_ns) {
+		gap = now - jitter.last_ns;
+		for (b = 0; b < JITTER_BUCKETS-1 && gap >= limit; b++)
+			limit *= 10;
+		jitter.histogram[b]++;
+		jitter.count++;
+		if (gap > jitter.worst_ns)
+			jitter.worst_ns = gap;
+	}
+}
+
+/* Wait for (at least) the given number of nanoseconds */
+void delay_ns(unsigned int howLong)
+{
+	if (howLong == 0)
+		return;
+
+	if (__builtin_expect(jitter.enabled, 0)) {
+		record_gap(delay_now_ns());
+		wait_ns(howLong);
+		jitter.last_ns = delay_now_ns();
+		return;
+	}
+
+	wait_ns(howLong);
+}
+
+/* Record the gaps between consecutive delays (real-time mode) */
+void delay_jitter_enable(bool enable)
+{
+	jitter.enabled = enable;
+	jitter.last_ns = 0;
+}
+
+void delay_us(unsigned int howLong)
+{
+	while (howLong > 1000000) {
+		delay_ns(1000000000);
+		howLong -= 1000000;
+	}
+	delay_ns(howLong*1000);
+}
+
+/*
+ * Wait for a bit-level delay: a PGC high or low time, or a PGD setup or
+ * hold time. Only these delays, which every command (and so the device ID
+ * reads of the link training) goes through, are scaled by
+ * delay_set_scale(); all the others, including the ones with a maximum in
+ * the programming specs and the erase and programming times, always have
+ * their nominal length.
+ */
+void delay_bit_ns(unsigned int howLong)
+{
+	if (__builtin_expect(scale != 100, 0))
+		howLong = (uint64_t)howLong*scale/100;
+	delay_ns(howLong);
+}
+
+void delay_bit_us(unsigned int howLong)
+{
+	delay_bit_ns(howLong*1000);
+}
+
+/* Scale the bit-level delays to percent of their nominal length */
+void delay_set_scale(unsigned int percent)
+{
+	scale = percent;
+}
+
+/* Set the wait length (in microseconds) above which delays sleep; 0 = never */
+void delay_set_sleep_threshold(unsigned int us)
+{
+	sleep_threshold_ns = (uint64_t)us*1000;
+	if (sleep_threshold_ns && sleep_threshold_ns < 2*DELAY_SPIN_MARGIN)
+		sleep_threshold_ns = 2*DELAY_SPIN_MARGIN;
+}
+
+static uint64_t cpu_time_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)*1000000ULL +
+			ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/* Start collecting statistics for a new operation */
+void delay_stats_reset(void)
+{
+	stats.start_ns = delay_now_ns();
+	stats.slept_ns = 0;
+	stats.cpu_start_us = cpu_time_us();
+
+	jitter.last_ns = 0;
+	jitter.worst_ns = 0;
+	jitter.count = 0;
+	memset(jitter.histogram, 0, sizeof(jitter.histogram));
+}
+
+/* Print wall-clock, CPU and sleep time since the last delay_stats_reset() */
+void delay_stats_report(void)
+{
+	uint64_t wall_us = (delay_now_ns() - stats.start_ns)/1000;
+	uint64_t cpu_us = cpu_time_us() - stats.cpu_start_us;
+
+	fprintf(stderr, "Timing: %llu ms elapsed, %llu ms CPU, %llu ms slept "
+			"instead of spinning\n",
+			(unsigned long long)wall_us/1000,
+			(unsigned long long)cpu_us/1000,
+			(unsigned long long)stats.slept_ns/1000000);
+
+	if (jitter.enabled && jitter.count) {
+		fprintf(stderr, "Edge gaps: %lu, worst %llu.%03llu us "
+				"[<1us: %lu, <10us: %lu, <100us: %lu, <1ms: %lu, >=1ms: %lu]\n",
+				jitter.count,
+				(unsigned long long)jitter.worst_ns/1000,
+				(unsigned long long)jitter.worst_ns%1000,
+				jitter.histogram[0], jitter.histogram[1], jitter.histogram[2],
+				jitter.histogram[3], jitter.histogram[4]);
+	}
+}
+
+static bool read_boot_id(char *boot_id, size_t len)
+{
+	FILE *fp;
+	bool ret;
+
+	fp = fopen(DELAY_BOOTID, "r");
+	if (fp == NULL)
+		return false;
+	ret = (fgets(boot_id, len, fp) != NULL);
+	fclose(fp);
+	if (ret)
+		boot_id[strcspn(boot_id, "\n")] = '\0';
+
+	return ret;
+}
+
+/* Check a calibration against a short (about 100us) spin, best of 3 */
+static bool check_calibration(const struct delay_calibration &c)
+{
+	const uint64_t expected = 100000;	// ns
+	uint64_t t0, t1, best = ~0ULL;
+
+	for (int run = 0; run < 3; run++) {
+		t0 = delay_now_ns();
+		spin_loops(c.loops_per_us*100);
+		t1 = delay_now_ns();
+		if (t1 - t0 < best)
+			best = t1 - t0;
+	}
+
+	return best >= expected*9/10 && best <= expected*3/2;
+}
+
+static bool load_calibration(const char *boot_id)
+{
+	FILE *fp;
+	char cached_id[64];
+	struct delay_calibration c;
+	int nread;
+
+	fp = cache_fopen(DELAY_CALFILE);
+	if (fp == NULL)
+		return false;
+	nread = fscanf(fp, "%63s %u %u", cached_id, &c.clock_ns, &c.loops_per_us);
+	fclose(fp);
+
+	if (nread != 3 || strcmp(cached_id, boot_id) || c.loops_per_us == 0 ||
+			c.loops_per_us > 100000 || !check_calibration(c))
+		return false;
+
+	cal = c;
+	return true;
+}
+
+static void save_calibration(const char *boot_id)
+{
+	FILE *fp;
+	char tmp[256];
+
+	fp = cache_create(DELAY_CALFILE, tmp, sizeof(tmp));
+	if (fp == NULL)
+		return;
+	fprintf(fp, "%s %u %u\n", boot_id, cal.clock_ns, cal.loops_per_us);
+	cache_commit(fp, tmp, DELAY_CALFILE, true);
+}
+
+/* Measure clock read cost and spin loop speed, keeping the best of 5 runs */
+static void calibrate(void)
+{
+	const uint32_t clock_reads = 1000;
+	const uint32_t loops = 1000000;
+	uint64_t t0, t1, best_clock = ~0ULL, best_loops = ~0ULL;
+
+	for (int run = 0; run < 5; run++) {
+		t0 = delay_now_ns();
+		for (uint32_t i = 0; i < clock_reads; i++)
+			delay_now_ns();
+		t1 = delay_now_ns();
+		if (t1 - t0 < best_clock)
+			best_clock = t1 - t0;
+
+		t0 = delay_now_ns();
+		spin_loops(loops);
+		t1 = delay_now_ns();
+		if (t1 - t0 < best_loops)
+			best_loops = t1 - t0;
+	}
+
+	cal.clock_ns = best_clock/clock_reads;
+	cal.loops_per_us = (uint64_t)loops*1000/(best_loops ? best_loops : 1);
+	if (cal.loops_per_us == 0)
+		cal.loops_per_us = 1;
+}
+
+/* Load the delay calibration from disk, calibrating if needed */
+void delay_init(void)
+{
+	char boot_id[64] = "unknown";
+	bool have_id;
+
+	have_id = read_boot_id(boot_id, sizeof(boot_id));
+
+	if (!have_id || !load_calibration(boot_id)) {
+		if (flags.debug) cerr << "Calibrating delays..." << endl;
+		calibrate();
+		if (have_id)
+			save_calibration(boot_id);
+	}
+
+	if (flags.debug)
+		fprintf(stderr, "Delay calibration: clock read %u ns, %u loops/us\n",
+				cal.clock_ns, cal.loops_per_us);
+}
@@ -20,12 +20,95 @@
  
 #ifndef DEVICE_H_
 #define DEVICE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <vector>
  
- struct memory{
+/*
+ * Sparse memory image, in 16-bit words. Words are stored in pages of
+ * MEMORY_PAGE_WORDS (4 KiB of data), allocated when a word of the page is
+ * first written; words never written read as 0 and are not filled.
+ * Each page has a bitmap of its filled words, scanned a machine word
+ * (MEMORY_FILL_BITS locations) at a time.
+ */
+#define MEMORY_PAGE_SHIFT	11
+#define MEMORY_PAGE_WORDS	(1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_FILL_BITS	(8 * sizeof(unsigned long))
+
+struct memory_extent{
+		uint32_t	start;		// first filled word
+		uint32_t	end;		// first empty word after it
+};
+
+class memory{
+
+	public:
 		uint32_t	program_memory_size;   	// size in WORDS (16bits each)
 		uint32_t	code_memory_size;		// size in WORDS (16bits each)
-		uint16_t	*location;		// 16-bit data
-		bool		*filled;		// 1 if the corresponding location is used
+
+		memory() : program_memory_size(0), code_memory_size(0), pages(0),
+				npages(0), extents_valid(false) {};
+		~memory() {clear();};
+		memory(const memory &) = delete;
+		memory &operator=(const memory &) = delete;
+
+		void init(uint32_t size);		// empty image of size words
+		void clear(void);				// release all the pages, size 0
+
+		uint16_t get(uint32_t addr) const {
+			const page *p = page_at(addr);
+			return p ? p->location[addr & (MEMORY_PAGE_WORDS-1)] : 0;
+		};
+		bool filled(uint32_t addr) const {
+			const page *p = page_at(addr);
+			uint32_t i = addr & (MEMORY_PAGE_WORDS-1);
+			return p ? (p->filled[i / MEMORY_FILL_BITS] >>
+					(i % MEMORY_FILL_BITS)) & 1 : false;
+		};
+		void put(uint32_t addr, uint16_t data);
+		uint32_t put_block(uint32_t addr, const uint8_t *data, uint32_t count);
+
+		/* filled words in [addr, addr+count) */
+		bool any_filled(uint32_t addr, uint32_t count) const;
+		uint32_t count_filled(uint32_t addr, uint32_t count) const;
+
+		/* present pages, in address order */
+		bool next_page(uint32_t &addr) const;
+		uint32_t next_filled(uint32_t addr) const;
+		uint32_t next_empty(uint32_t addr) const;
+		uint32_t page_count(void) const;
+
+		/*
+		 * Runs of filled words, and rows of row_words words holding any
+		 * filled word, in address order. Both are built on first use and
+		 * kept until the image changes.
+		 */
+		const std::vector<memory_extent> &extents(void);
+		const std::vector<uint32_t> &rows(uint32_t row_words);
+		uint32_t next_row(uint32_t addr, uint32_t row_words);
+
+	private:
+		struct page{
+			uint16_t		location[MEMORY_PAGE_WORDS];	// 16-bit data
+			unsigned long	filled[MEMORY_PAGE_WORDS / MEMORY_FILL_BITS];	// used locations
+		};
+
+		const page *page_at(uint32_t addr) const {
+			return (addr < program_memory_size) ?
+					pages[addr >> MEMORY_PAGE_SHIFT] : 0;
+		};
+
+		void invalidate(void);
+		page *page_for_write(uint32_t addr);
+
+		page		**pages;		// page directory, 0 = not present
+		uint32_t	npages;
+
+		bool							extents_valid;
+		std::vector<memory_extent>		extent_list;
+		std::map<uint32_t, std::vector<uint32_t> >	row_index;	// by row size
 };
 
 struct pic_device{
@@ -56,7 +139,7 @@ class Pic{
 		virtual bool read_device_id(void) = 0;
 		virtual void bulk_erase(void) = 0;
 		virtual void dump_configuration_registers(void) = 0;
-		virtual void read(char *outfile, uint32_t start=0, uint32_t count=0) = 0;
+		virtual bool read(char *outfile, uint32_t start=0, uint32_t count=0) = 0;
 		virtual void write(char *infile) = 0;
 		virtual uint8_t blank_check(void) = 0;
 		virtual void dump_user_id(void) = 0;
@@ -25,36 +25,36 @@
 
 #include "dspic33e.h"
 
-/* delays (in microseconds; nanoseconds are rounded to 1us) */
-#define DELAY_P1   			1		// 200ns
-#define DELAY_P1A			1		// 80ns
-#define DELAY_P1B			1		// 80ns
-#define DELAY_P2			1		// 15ns
-#define DELAY_P3			1		// 15ns
-#define DELAY_P4			1		// 40ns
-#define DELAY_P4A			1		// 40ns
-#define DELAY_P5			1		// 20ns
-#define DELAY_P6			1		// 100ns
-#define DELAY_P7_DSPIC33E	25000	// 25ms
-#define DELAY_P7_PIC24FJ	50000	// 50ms
-#define DELAY_P8			12		// 12us
-#define DELAY_P9A			10		// 10us
-#define DELAY_P9B			15		// 15us - 23us max!
-#define DELAY_P10			1		// 400ns
-#define DELAY_P11_DSPIC33E	116000	// 116ms
-#define DELAY_P11_PIC24FJ	25000	// 25ms
-#define DELAY_P12_DSPIC33E	23000	// 23ms
-#define DELAY_P12_PIC24FJ	25000	// 25ms
-#define DELAY_P13_DSPIC33E	1600	// 1.6ms
-#define DELAY_P13_PIC24FJ	20		// 20us
-#define DELAY_P14			1		// 1us MAX!
-#define DELAY_P15			1		// 10ns
+/* delays (in nanoseconds) */
+#define DELAY_P1   			200		// 200ns
+#define DELAY_P1A			80		// 80ns
+#define DELAY_P1B			80		// 80ns
+#define DELAY_P2			15		// 15ns
+#define DELAY_P3			15		// 15ns
+#define DELAY_P4			40		// 40ns
+#define DELAY_P4A			40		// 40ns
+#define DELAY_P5			20		// 20ns
+#define DELAY_P6			100		// 100ns
+#define DELAY_P7_DSPIC33E	25000000	// 25ms
+#define DELAY_P7_PIC24FJ	50000000	// 50ms
+#define DELAY_P8			12000		// 12us
+#define DELAY_P9A			10000		// 10us
+#define DELAY_P9B			15000		// 15us - 23us max!
+#define DELAY_P10			400		// 400ns
+#define DELAY_P11_DSPIC33E	116000000	// 116ms
+#define DELAY_P11_PIC24FJ	25000000	// 25ms
+#define DELAY_P12_DSPIC33E	23000000	// 23ms
+#define DELAY_P12_PIC24FJ	25000000	// 25ms
+#define DELAY_P13_DSPIC33E	1600000	// 1.6ms
+#define DELAY_P13_PIC24FJ	20000		// 20us
+#define DELAY_P14			1000		// 1us MAX!
+#define DELAY_P15			10		// 10ns
 #define DELAY_P16			0		// 0s
 #define DELAY_P17   		0		// 0s - 100ns MAX!
-#define DELAY_P18			1000	// 1ms
-#define DELAY_P19			1		// 25ns
-#define DELAY_P20			25000	// 25ms
-#define DELAY_P21			1		// 1us - 500us MAX!
+#define DELAY_P18			1000000	// 1ms
+#define DELAY_P19			25		// 25ns
+#define DELAY_P20			25000000	// 25ms
+#define DELAY_P21			1000		// 1us - 500us MAX!
 
 #define ENTER_PROGRAM_KEY	0x4D434851
 
@@ -74,12 +74,12 @@ void dspic33e::send_cmd(uint32_t cmd)
 	/* send the SIX = 0x0000 instruction */
 	for (i = 0; i < 4; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(DELAY_P4);
 
 	/* send the 24-bit command */
 	for (i = 0; i < 24; i++) {
@@ -87,13 +87,13 @@ void dspic33e::send_cmd(uint32_t cmd)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 	}
 
-	delay_us(DELAY_P4A);
+	delay_ns(DELAY_P4A);
 
 }
 
@@ -107,9 +107,9 @@ inline void dspic33e::send_prog_nop(void)
 	/* send 5 NOP commands */
 	for (i = 0; i < 140; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 	}
 }
 
@@ -128,36 +128,38 @@ uint16_t dspic33e::read_data(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(DELAY_P4);
 
 	/* idle for 8 clock cycles, waiting for the data to be ready */
 	for (i = 0; i < 8; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
 
-	delay_us(DELAY_P5);
+	delay_ns(DELAY_P5);
 
 	GPIO_IN(pic_data);
 
 	/* read a 16-bit data word */
+	gang_word_begin();
 	for (i = 0; i < 16; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
+	gang_word_end();
 
-	delay_us(DELAY_P4A);
+	delay_ns(DELAY_P4A);
 	GPIO_OUT(pic_data);
 	return data;
 }
@@ -173,11 +175,11 @@ void dspic33e::enter_program_mode(void)
 	GPIO_CLR(pic_clk);
 
 	GPIO_CLR(pic_mclr);		/*  remove VDD from MCLR pin */
-	delay_us(DELAY_P6);
+	delay_ns(DELAY_P6);
 	GPIO_SET(pic_mclr);		/*  apply VDD to MCLR pin */
-	delay_us(DELAY_P21);
+	delay_ns(DELAY_P21);
 	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P18);
+	delay_ns(DELAY_P18);
 
 	/* Shift in the "enter program mode" key sequence (MSB first) */
 	for (i = 31; i > -1; i--) {
@@ -185,26 +187,26 @@ void dspic33e::enter_program_mode(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 
 	}
 	GPIO_CLR(pic_data);
-	delay_us(DELAY_P19);
+	delay_ns(DELAY_P19);
 	GPIO_SET(pic_mclr);
 	if(subfamily == SF_DSPIC33E)
-		delay_us(DELAY_P7_DSPIC33E);
+		delay_ns(DELAY_P7_DSPIC33E);
 	else if(subfamily == SF_PIC24FJ)
-		delay_us(DELAY_P7_PIC24FJ);
+		delay_ns(DELAY_P7_PIC24FJ);
 
 	/* idle for 5 clock cycles */
 	for (i = 0; i < 5; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
 
 }
@@ -214,9 +216,9 @@ void dspic33e::exit_program_mode(void)
 {
 	GPIO_CLR(pic_clk);
 	GPIO_CLR(pic_data);
-	delay_us(DELAY_P16);
+	delay_ns(DELAY_P16);
 	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P17);	/* wait (at least) P17 */
+	delay_ns(DELAY_P17);	/* wait (at least) P17 */
 	GPIO_SET(pic_mclr);
 	GPIO_IN(pic_mclr);
 }
@@ -265,9 +267,7 @@ bool dspic33e::read_device_id(void)
 
 			strcpy(name, piclist[i].name);
 			mem.code_memory_size = piclist[i].code_memory_size;
-			mem.program_memory_size = 0x0F80018;
-			mem.location = (uint16_t*) calloc(mem.program_memory_size,sizeof(uint16_t));
-			mem.filled = (bool*) calloc(mem.program_memory_size,sizeof(bool));
+			mem.init(0x0F80018);
 			found = 1;
 			break;
 		}
@@ -359,6 +359,7 @@ uint8_t dspic33e::blank_check(void)
 		send_nop();
 		send_nop();
 
+		gang_expect_block(mem, addr, true);
 		/* read six data words (16 bits each) */
 		for(i=0; i<6; i++){
 			send_cmd(0x887C40 + i);
@@ -394,7 +395,8 @@ uint8_t dspic33e::blank_check(void)
 			if(flags.debug)			
 				fprintf(stderr, "\n addr = 0x%06X data = 0x%04X",
 								(addr+i), data[i]);
-			if ((i%2 == 0 && data[i] != 0xFFFF) || (i%2 == 1 && data[i] != 0x00FF)) {
+			if (gang_targets() == 1 &&
+					((i%2 == 0 && data[i] != 0xFFFF) || (i%2 == 1 && data[i] != 0x00FF))) {
 				if(!flags.debug) cerr << "\b\b\b\b\b";
 				ret = 1;
 				addr = mem.code_memory_size + 10;
@@ -446,9 +448,9 @@ void dspic33e::bulk_erase(void)
 	send_nop();
 
 	if(subfamily == SF_DSPIC33E)
-		delay_us(DELAY_P11_DSPIC33E);
+		delay_ns(DELAY_P11_DSPIC33E);
 	else if(subfamily == SF_PIC24FJ)
-		delay_us(DELAY_P11_PIC24FJ);
+		delay_ns(DELAY_P11_PIC24FJ);
 
 	/* wait while the erase operation completes */
 	do{
@@ -470,11 +472,12 @@ void dspic33e::bulk_erase(void)
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
+bool dspic33e::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint32_t addr, startaddr, stopaddr;
 	uint16_t data[8], raw_data[6];
 	int i=0;
+	hex_sink sink(outfile, mem.program_memory_size);
 
 	startaddr = start;
 	stopaddr = mem.code_memory_size;
@@ -591,13 +594,11 @@ void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
 						(addr+i), data[i]);
 
 			if (i%2 == 0 && data[i] != 0xFFFF) {
-				mem.location[addr+i]        = data[i];
-				mem.filled[addr+i]      = 1;
+				sink.put(addr+i, data[i]);
 			}
 
 			if (i%2 == 1 && data[i] != 0x00FF) {
-				mem.location[addr+i]        = data[i];
-				mem.filled[addr+i]      = 1;
+				sink.put(addr+i, data[i]);
 			}
 		}
 
@@ -637,8 +638,7 @@ void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
 		send_nop();
 		data[0] = read_data();
 		if (data[0] != 0xFFFF) {
-			mem.location[addr+2*i] = data[0];
-			mem.filled[addr+2*i] = 1;
+			sink.put(addr+2*i, data[0]);
 		}
 	}
 
@@ -652,15 +652,13 @@ void dspic33e::read(char *outfile, uint32_t start, uint32_t count)
 
 	if(!flags.debug) cerr << "\b\b\b\b\b";
 	if(flags.client) fprintf(stdout, "@FIN");
-	write_inhx(&mem, outfile);
+	return sink.close();
 }
 
 /* Write contents of the .hex file to the PIC */
 void dspic33e::write(char *infile)
 {
 	uint16_t i,j,p;
-	uint16_t k;
-	bool skip;
 	uint32_t data[8],raw_data[6];
 	uint32_t addr = 0;
 
@@ -688,17 +686,8 @@ void dspic33e::write(char *infile)
 	if(flags.client) fprintf(stdout, "@000");
 	counter=0;
 
-	for (addr = 0; addr < mem.code_memory_size; ){
-
-		skip = 1;
-
-		for(k=0; k<256; k+=2)
-			if(mem.filled[addr+k]) skip = 0;
-
-		if(skip){
-			addr=addr+256;
-			continue;
-		}
+	for (addr = mem.next_row(0, 256); addr < mem.code_memory_size;
+			addr = mem.next_row(addr, 256)){
 
 		/* Set the NVMADRU/NVMADR register-pair to point to the correct row */
 		send_cmd(0x200002 | ((addr & 0x0000FFFF) << 4) );
@@ -713,7 +702,7 @@ void dspic33e::write(char *infile)
 		for(p=0; p<32; p++){
 
 			for(j=0;j<8;j++){
-				if (mem.filled[addr+j]) data[j] = mem.location[addr+j];
+				if (mem.filled(addr+j)) data[j] = mem.get(addr+j);
 				else data[j] = 0xFFFF;
 				if(flags.debug)
 					fprintf(stderr,"\n  Writing 0x%04X to address 0x%06X ", data[j], addr+j );
@@ -772,9 +761,9 @@ void dspic33e::write(char *infile)
 		send_prog_nop();	// FIXME: timing???
 
 		if(subfamily == SF_DSPIC33E)
-			delay_us(DELAY_P13_DSPIC33E);
+			delay_ns(DELAY_P13_DSPIC33E);
 		else if(subfamily == SF_PIC24FJ)
-			delay_us(DELAY_P13_PIC24FJ);
+			delay_ns(DELAY_P13_PIC24FJ);
 
 		do{
 			send_nop();
@@ -826,9 +815,9 @@ void dspic33e::write(char *infile)
 
 	for(i=0; i<8; i++){
 
-		if(mem.filled[addr]){
+		if(mem.filled(addr)){
 
-			send_cmd(0x200000 | ((0x0000FFFF & mem.location[addr]) << 4));
+			send_cmd(0x200000 | ((0x0000FFFF & mem.get(addr)) << 4));
 
 			send_cmd(0xBB0B80);
 			send_nop();
@@ -855,7 +844,7 @@ void dspic33e::write(char *infile)
 			send_nop();
 			send_nop();
 
-			delay_us(DELAY_P20);
+			delay_ns(DELAY_P20);
 
 			do{
 				send_nop();
@@ -875,7 +864,7 @@ void dspic33e::write(char *infile)
 
 			if(flags.debug)
 				fprintf(stderr,"\n - %s set to 0x%01x",
-						regname[i], mem.location[addr]);
+						regname[i], mem.get(addr));
 		}
 		else if(flags.debug)
 				fprintf(stderr,"\n - %s left unchanged", regname[i]);
@@ -901,15 +890,8 @@ void dspic33e::write(char *infile)
 		send_nop();
 		send_nop();
 
-		for(addr=0; addr < mem.code_memory_size; addr=addr+8) {
-
-			skip=1;
-
-			for(k=0; k<8; k+=2)
-				if(mem.filled[addr+k])
-					skip = 0;
-
-			if(skip) continue;
+		for (addr = mem.next_row(0, 8); addr < mem.code_memory_size;
+				addr = mem.next_row(addr + 8, 8)) {
 
 			send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );	// MOV #<DestAddress23:16>, W0
 			send_cmd(0x8802A0);									// MOV W0, TBLPAG
@@ -967,6 +949,7 @@ void dspic33e::write(char *infile)
 			send_nop();
 			send_nop();
 
+			gang_expect_block(mem, addr);
 			/* read six data words (16 bits each) */
 			for(i=0; i<6; i++){
 				send_cmd(0x887C40 + i);
@@ -997,9 +980,10 @@ void dspic33e::write(char *infile)
 				if (flags.debug)
 					fprintf(stderr, "\n addr = 0x%06X data = 0x%04X", (addr+i), data[i]);
 
-				if(mem.filled[addr+i] && data[i] != mem.location[addr+i]){
+				if(mem.filled(addr+i) && data[i] != mem.get(addr+i) &&
+						gang_targets() == 1){
 					fprintf(stderr,"\n\n ERROR at address %06X: written %04X but %04X read!\n\n",
-									addr+i, mem.location[addr+i], data[i]);
+									addr+i, mem.get(addr+i), data[i]);
 					return;
 				}
 
@@ -25,32 +25,32 @@
 
 #include "dspic33f.h"
 
-/* delays (in microseconds; nanoseconds are rounded to 1us) */
-#define DELAY_P1   		1		// 200ns
-#define DELAY_P1A		1		// 80ns
-#define DELAY_P1B		1		// 80ns
-#define DELAY_P2		1		// 15ns
-#define DELAY_P3		1		// 15ns
-#define DELAY_P4		1		// 40ns
-#define DELAY_P4A		1		// 40ns
-#define DELAY_P5		1		// 20ns
-#define DELAY_P6		1		// 100ns
-#define DELAY_P7		25000	// 25ms
-#define DELAY_P8		12		// 12us
-#define DELAY_P9A		10		// 10us
-#define DELAY_P9B		15		// 15us - 23us max!
-#define DELAY_P10		1		// 400ns
-#define DELAY_P11		330000	// 330ms
-#define DELAY_P12		19500	// 19.5ms
-#define DELAY_P13		1280	// 1.28ms
-#define DELAY_P14		1		// 1us MAX!
-#define DELAY_P15		1		// 10ns
+/* delays (in nanoseconds) */
+#define DELAY_P1   		200		// 200ns
+#define DELAY_P1A		80		// 80ns
+#define DELAY_P1B		80		// 80ns
+#define DELAY_P2		15		// 15ns
+#define DELAY_P3		15		// 15ns
+#define DELAY_P4		40		// 40ns
+#define DELAY_P4A		40		// 40ns
+#define DELAY_P5		20		// 20ns
+#define DELAY_P6		100		// 100ns
+#define DELAY_P7		25000000	// 25ms
+#define DELAY_P8		12000		// 12us
+#define DELAY_P9A		10000		// 10us
+#define DELAY_P9B		15000		// 15us - 23us max!
+#define DELAY_P10		400		// 400ns
+#define DELAY_P11		330000000	// 330ms
+#define DELAY_P12		19500000	// 19.5ms
+#define DELAY_P13		1280000	// 1.28ms
+#define DELAY_P14		1000		// 1us MAX!
+#define DELAY_P15		10		// 10ns
 #define DELAY_P16		0		// 0s
 #define DELAY_P17   	0		// 0s - 100ns MAX!
-#define DELAY_P18		1		// 1us
-#define DELAY_P19		1		// 25ns
-#define DELAY_P20		1		// 1us - 25ms MAX!
-#define DELAY_P21		1		// 1us - 500us MAX!
+#define DELAY_P18		1000		// 1us
+#define DELAY_P19		25		// 25ns
+#define DELAY_P20		1000		// 1us - 25ms MAX!
+#define DELAY_P21		1000		// 1us - 500us MAX!
 
 #define ENTER_PROGRAM_KEY	0x4D434851
 
@@ -60,6 +60,54 @@
 static unsigned int counter=0;
 static uint16_t nvmcon;
 
+static const icsp_timing timing = {DELAY_P1A, DELAY_P1B, DELAY_P4, DELAY_P4A,
+									DELAY_P5};
+
+/*
+ * Pre-render the fixed command runs of the memory loops. fetch_block is
+ * the body shared by read, blank check and verify: fetch the next four
+ * memory locations (W6 pointing to them) into W0:W5, read W0:W5 out
+ * through VISI and reset the PC. latch_block loads the six MOV commands
+ * given as operands into W0:W5, then writes them to the write latches.
+ */
+dspic33f::dspic33f() : fetch_block(timing), latch_block(timing)
+{
+	const uint32_t fetch[] = {0xBA1B96, 0xBADBB6, 0xBADBD6, 0xBA1BB6,
+							  0xBA1B96, 0xBADBB6, 0xBADBD6, 0xBA0BB6};
+
+	fetch_block.six(0xEB0380);
+	fetch_block.nop();
+	for (int i = 0; i < 8; i++) {
+		fetch_block.six(fetch[i]);
+		fetch_block.nop();
+		fetch_block.nop();
+	}
+
+	for (int i = 0; i < 6; i++) {
+		fetch_block.six(0x883C20 + i);
+		fetch_block.nop();
+		fetch_block.nop();
+		fetch_block.regout(i);
+		fetch_block.nop();
+	}
+
+	fetch_block.six(0x040200);	// reset_pc()
+	fetch_block.nop();
+
+	const uint32_t latch[] = {0xBB0BB6, 0xBBDBB6, 0xBBEBB6, 0xBB1BB6,
+							  0xBB0BB6, 0xBBDBB6, 0xBBEBB6, 0xBB1BB6};
+
+	for (int i = 0; i < 6; i++)
+		latch_block.six_operand(i);
+	latch_block.six(0xEB0300);
+	latch_block.nop();
+	for (int i = 0; i < 8; i++) {
+		latch_block.six(latch[i]);
+		latch_block.nop();
+		latch_block.nop();
+	}
+}
+
 /* Send a 24-bit command to the PIC (LSB first) through a SIX instruction */
 void dspic33f::send_cmd(uint32_t cmd)
 {
@@ -70,12 +118,12 @@ void dspic33f::send_cmd(uint32_t cmd)
 	/* send the SIX = 0x0000 instruction */
 	for (i = 0; i < 4; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(DELAY_P4);
 
 	/* send the 24-bit command */
 	for (i = 0; i < 24; i++) {
@@ -83,13 +131,13 @@ void dspic33f::send_cmd(uint32_t cmd)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 	}
 
-	delay_us(DELAY_P4A);
+	delay_ns(DELAY_P4A);
 
 }
 
@@ -108,36 +156,38 @@ uint16_t dspic33f::read_data(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(DELAY_P4);
 
 	/* idle for 8 clock cycles, waiting for the data to be ready */
 	for (i = 0; i < 8; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
 
-	delay_us(DELAY_P5);
+	delay_ns(DELAY_P5);
 
 	GPIO_IN(pic_data);
 
 	/* read a 16-bit data word */
+	gang_word_begin();
 	for (i = 0; i < 16; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
+	gang_word_end();
 
-	delay_us(DELAY_P4A);
+	delay_ns(DELAY_P4A);
 	GPIO_OUT(pic_data);
 	return data;
 }
@@ -153,11 +203,11 @@ void dspic33f::enter_program_mode(void)
 	GPIO_CLR(pic_clk);
 
 	GPIO_CLR(pic_mclr);		/*  remove VDD from MCLR pin */
-	delay_us(DELAY_P6);
+	delay_ns(DELAY_P6);
 	GPIO_SET(pic_mclr);		/*  apply VDD to MCLR pin */
-	delay_us(DELAY_P21);
+	delay_ns(DELAY_P21);
 	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P18);
+	delay_ns(DELAY_P18);
 
 	/* Shift in the "enter program mode" key sequence (MSB first) */
 	for (i = 31; i > -1; i--) {
@@ -165,23 +215,23 @@ void dspic33f::enter_program_mode(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 
 	}
 	GPIO_CLR(pic_data);
-	delay_us(DELAY_P19);
+	delay_ns(DELAY_P19);
 	GPIO_SET(pic_mclr);
-	delay_us(DELAY_P7);
+	delay_ns(DELAY_P7);
 
 	/* idle for 5 clock cycles */
 	for (i = 0; i < 5; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
 
 }
@@ -191,9 +241,9 @@ void dspic33f::exit_program_mode(void)
 {
 	GPIO_CLR(pic_clk);
 	GPIO_CLR(pic_data);
-	delay_us(DELAY_P16);
+	delay_ns(DELAY_P16);
 	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P17);	/* wait (at least) P17 */
+	delay_ns(DELAY_P17);	/* wait (at least) P17 */
 	GPIO_SET(pic_mclr);
 	GPIO_IN(pic_mclr);
 }
@@ -232,9 +282,7 @@ bool dspic33f::read_device_id(void)
 
 			strcpy(name,piclist[i].name);
 			mem.code_memory_size = piclist[i].code_memory_size;
-			mem.program_memory_size = 0x0F80018;
-			mem.location = (uint16_t*) calloc(mem.program_memory_size,sizeof(uint16_t));
-			mem.filled = (bool*) calloc(mem.program_memory_size,sizeof(bool));
+			mem.init(0x0F80018);
 			found = 1;
 			break;
 		}
@@ -269,45 +317,9 @@ uint8_t dspic33f::blank_check(void)
 			send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) );	// MOV #<DestAddress15:0>, W6
 		}
 
-		/* Fetch the next four memory locations and put them to W0:W5 */
-		send_cmd(0xEB0380);
-		send_nop();
-		send_cmd(0xBA1B96);
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBB6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBD6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBA1BB6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBA1B96);
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBB6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBD6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBA0BB6);
-		send_nop();
-		send_nop();
-
-		/* read six data words (16 bits each) */
-		for(i=0; i<6; i++){
-			send_cmd(0x883C20 + i);
-			send_nop();
-			send_nop();
-			raw_data[i] = read_data();
-			send_nop();
-		}
-
-		reset_pc();
-		send_nop();
+		/* Fetch the next four memory locations and read them from W0:W5 */
+		gang_expect_block(mem, addr, true);
+		fetch_block.run(0, raw_data);
 
 		/* store data correctly */
 		data[0] = raw_data[0];
@@ -325,7 +337,8 @@ uint8_t dspic33f::blank_check(void)
 		}
 
 		for(i=0; i<8; i++)
-			if ((i%2 == 0 && data[i] != 0xFFFF) || (i%2 == 1 && data[i] != 0x00FF)) {
+			if (gang_targets() == 1 &&
+					((i%2 == 0 && data[i] != 0xFFFF) || (i%2 == 1 && data[i] != 0x00FF))) {
 				if(!flags.debug) cerr << "\b\b\b\b\b";
 				ret = 1;
 				addr = mem.code_memory_size + 10;
@@ -376,11 +389,12 @@ void dspic33f::bulk_erase(void)
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void dspic33f::read(char *outfile, uint32_t start, uint32_t count)
+bool dspic33f::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint32_t addr, startaddr, stopaddr;
 	uint16_t data[8], raw_data[6];
 	int i=0;
+	hex_sink sink(outfile, mem.program_memory_size);
 
 	startaddr = start;
 	stopaddr = mem.code_memory_size;
@@ -409,45 +423,8 @@ void dspic33f::read(char *outfile, uint32_t start, uint32_t count)
 			startaddr = 0;
 		}
 
-		/* Fetch the next four memory locations and put them to W0:W5 */
-		send_cmd(0xEB0380);
-		send_nop();
-		send_cmd(0xBA1B96);
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBB6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBD6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBA1BB6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBA1B96);
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBB6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBADBD6);
-		send_nop();
-		send_nop();
-		send_cmd(0xBA0BB6);
-		send_nop();
-		send_nop();
-
-		/* read six data words (16 bits each) */
-		for(i=0; i<6; i++){
-			send_cmd(0x883C20 + i);
-			send_nop();
-			send_nop();
-			raw_data[i] = read_data();
-			send_nop();
-		}
-
-		reset_pc();
-		send_nop();
+		/* Fetch the next four memory locations and read them from W0:W5 */
+		fetch_block.run(0, raw_data);
 
 		/* store data correctly */
 		data[0] = raw_data[0];
@@ -465,13 +442,11 @@ void dspic33f::read(char *outfile, uint32_t start, uint32_t count)
 						(addr+i), data[i]);
 
 			if (i%2 == 0 && data[i] != 0xFFFF) {
-				mem.location[addr+i]        = data[i];
-				mem.filled[addr+i]      = 1;
+				sink.put(addr+i, data[i]);
 			}
 
 			if (i%2 == 1 && data[i] != 0x00FF) {
-				mem.location[addr+i]        = data[i];
-				mem.filled[addr+i]      = 1;
+				sink.put(addr+i, data[i]);
 			}
 		}
 
@@ -504,23 +479,22 @@ void dspic33f::read(char *outfile, uint32_t start, uint32_t count)
 		send_nop();
 		data[0] = read_data();
 		if (data[0] != 0xFFFF) {
-			mem.location[addr+2*i] = data[0];
-			mem.filled[addr+2*i] = 1;
+			sink.put(addr+2*i, data[0]);
 		}
 	}
 
 	if(!flags.debug) cerr << "\b\b\b\b\b";
 	if(flags.client) fprintf(stdout, "@FIN");
-	write_inhx(&mem, outfile);
+	return sink.close();
 }
 
 /* Write contents of the .hex file to the PIC */
 void dspic33f::write(char *infile)
 {
-	uint8_t i,j,k,p;
-	bool skip, skipped=0;
-	uint32_t data[8],raw_data[6];
-	uint32_t addr = 0;
+	uint8_t i,j,p;
+	uint32_t data[8], operands[6];
+	uint16_t raw_data[6];
+	uint32_t addr = 0, next = 0;
 
 	unsigned int filled_locations=1;
 
@@ -546,17 +520,8 @@ void dspic33f::write(char *infile)
 	send_cmd(0x24001A);
 	send_cmd(0x883B0A);
 
-	for (addr = 0; addr < mem.code_memory_size; ){
-
-		skip = 1;
-
-		for(k=0; k<128; k+=2)
-			if(mem.filled[addr+k]) skip = 0;
-
-		if(skip){
-			addr=addr+128;
-			continue;
-		}
+	for (addr = mem.next_row(0, 128); addr < mem.code_memory_size;
+			addr = mem.next_row(addr, 128)){
 
 		send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );
 		send_cmd(0x880190);
@@ -565,46 +530,21 @@ void dspic33f::write(char *infile)
 		for(p=0; p<16; p++){
 
 			for(j=0;j<8;j++){
-				if (mem.filled[addr+j]) data[j] = mem.location[addr+j];
+				if (mem.filled(addr+j)) data[j] = mem.get(addr+j);
 				else data[j] = 0xFFFF;
 				if(flags.debug)
 					fprintf(stderr,"\n  Writing 0x%04X to address 0x%06X ", data[j], addr+j );
 			}
 
-			send_cmd(0x200000 | (data[0] << 4));										// MOV #<LSW0>, W0
-			send_cmd(0x200001 | (0x00FFFF & ((data[3] << 8) | (data[1] & 0x00FF))) <<4);// MOV #<MSB1:MSB0>, W1
-			send_cmd(0x200002 | (data[2] << 4));										// MOV #<LSW1>, W2
-			send_cmd(0x200003 | (data[4] << 4));										// MOV #<LSW2>, W3
-			send_cmd(0x200004 | (0x00FFFF & ((data[7] << 8) | (data[5] & 0x00FF))) <<4);// MOV #<MSB3:MSB2>, W4
-			send_cmd(0x200005 | (data[6] << 4));										// MOV #<LSW3>, W5
+			operands[0] = 0x200000 | (data[0] << 4);										// MOV #<LSW0>, W0
+			operands[1] = 0x200001 | (0x00FFFF & ((data[3] << 8) | (data[1] & 0x00FF))) <<4;// MOV #<MSB1:MSB0>, W1
+			operands[2] = 0x200002 | (data[2] << 4);										// MOV #<LSW1>, W2
+			operands[3] = 0x200003 | (data[4] << 4);										// MOV #<LSW2>, W3
+			operands[4] = 0x200004 | (0x00FFFF & ((data[7] << 8) | (data[5] & 0x00FF))) <<4;// MOV #<MSB3:MSB2>, W4
+			operands[5] = 0x200005 | (data[6] << 4);										// MOV #<LSW3>, W5
 
-			/* set_W6_and_load_latches */
-			send_cmd(0xEB0300);
-			send_nop();
-			send_cmd(0xBB0BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBDBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBEBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB1BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB0BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBDBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBBEBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBB1BB6);
-			send_nop();
-			send_nop();
+			/* load W0:W5, set_W6_and_load_latches */
+			latch_block.run(operands);
 
 			addr = addr+8;
 		}
@@ -650,11 +590,11 @@ void dspic33f::write(char *infile)
 
 	for(i=0; i<12; i++){
 
-		if(mem.filled[addr+2*i]){
+		if(mem.filled(addr+2*i)){
 
 			send_cmd(0x200007 | (0x000FFFF0 & ((addr+2*i) << 4)));
 
-			send_cmd(0x200000 | (mem.location[addr+2*i] << 4));
+			send_cmd(0x200000 | (mem.get(addr+2*i) << 4));
 			send_cmd(0xBB1B80);
 			send_nop();
 			send_nop();
@@ -675,7 +615,7 @@ void dspic33f::write(char *infile)
 
 			if(flags.debug)
 				fprintf(stderr,"\n - %s set to 0x%02x",
-						regname[i], mem.location[addr+2*i]);
+						regname[i], mem.get(addr+2*i));
 		}
 
 	}
@@ -691,63 +631,20 @@ void dspic33f::write(char *infile)
 		reset_pc();
 		send_nop();
 
-		for(addr=0; addr < mem.code_memory_size; addr=addr+8) {
+		for (addr = mem.next_row(0, 8); addr < mem.code_memory_size;
+				addr = mem.next_row(addr + 8, 8)) {
 
-			for(k=0; k<8; k+=2)
-				if(mem.filled[addr+k]) skip = 0;
-				else skip =1;
-
-			if(((addr & 0x0000FFFF) == 0 || skipped) & !skip){
+			/* W6 already points here unless groups were skipped */
+			if((addr & 0x0000FFFF) == 0 || addr != next){
 				send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) );	// MOV #<DestAddress23:16>, W0
 				send_cmd(0x880190);									// MOV W0, TBLPAG
 				send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) );	// MOV #<DestAddress15:0>, W6
 			}
+			next = addr + 8;
 
-			if(skip){
-				skipped=1;
-				continue;
-			}
-			else skipped=0;
-
-			/* Fetch the next four memory locations and put them to W0:W5 */
-			send_cmd(0xEB0380);
-			send_nop();
-			send_cmd(0xBA1B96);
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBD6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBA1BB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBA1B96);
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBB6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBADBD6);
-			send_nop();
-			send_nop();
-			send_cmd(0xBA0BB6);
-			send_nop();
-			send_nop();
-
-			/* read six data words (16 bits each) */
-			for(i=0; i<6; i++){
-				send_cmd(0x883C20 + i);
-				send_nop();
-				send_nop();
-				raw_data[i] = read_data();
-				send_nop();
-			}
-
-			reset_pc();
-			send_nop();
+			/* Fetch the next four memory locations and read them from W0:W5 */
+			gang_expect_block(mem, addr);
+			fetch_block.run(0, raw_data);
 
 			/* store data correctly */
 			data[0] = raw_data[0];
@@ -764,9 +661,10 @@ void dspic33f::write(char *infile)
 					fprintf(stderr, "\n addr = 0x%06X data = 0x%04X",
 								(addr+i), data[i]);
 
-				if(mem.filled[addr+i] && data[i] != mem.location[addr+i]){
+				if(mem.filled(addr+i) && data[i] != mem.get(addr+i) &&
+						gang_targets() == 1){
 					fprintf(stderr,"\n\n ERROR at address %06X: written %04X but %04X read!\n\n",
-									addr+i, mem.location[addr+i], data[i]);
+									addr+i, mem.get(addr+i), data[i]);
 					return;
 				}
 
@@ -21,6 +21,7 @@
 #include <iostream>
 
 #include "../common.h"
+#include "../waveform.h"
 #include "device.h"
 
 using namespace std;
@@ -28,13 +29,15 @@ using namespace std;
 class dspic33f : public Pic{
 
 	public:
+		dspic33f();
+
 		void enter_program_mode(void);
 		void exit_program_mode(void);
 		bool setup_pe(void){return true;};
 		bool read_device_id(void);
 		void bulk_erase(void);
 		void dump_configuration_registers(void);
-		void read(char *outfile, uint32_t start, uint32_t count);
+		bool read(char *outfile, uint32_t start, uint32_t count);
 		void write(char *infile);
 		uint8_t blank_check(void);
 		void write_user_id(uint64_t){};
@@ -44,6 +47,8 @@ class dspic33f : public Pic{
 		void send_cmd(uint32_t cmd);
 		uint16_t read_data(void);
 
+		icsp_waveform fetch_block, latch_block;
+
 		/*
 		* DEVICES SECTION
 		*                       ID       NAME           	  MEMSIZE
@@ -69,18 +69,18 @@ void pic10f322::enter_program_mode(void)
 		else
 			GPIO_CLR(pic_data);
 
-		delay_us(DELAY_TCKL);	/* Setup time */
+		delay_bit_us(DELAY_TCKL);	/* Setup time */
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_TCKH);	/* Hold time */
+		delay_bit_us(DELAY_TCKH);	/* Hold time */
 		GPIO_CLR(pic_clk);
 
 	}
 	GPIO_CLR(pic_data);
 
 	//Last clock(Don't care data)
-	delay_us(DELAY_TCKL);	/* Setup time */
+	delay_bit_us(DELAY_TCKL);	/* Setup time */
 	GPIO_SET(pic_clk);
-	delay_us(DELAY_TCKH);	/* Hold time */
+	delay_bit_us(DELAY_TCKH);	/* Hold time */
 	GPIO_CLR(pic_clk);
 
 }
@@ -105,9 +105,9 @@ void pic10f322::send_cmd(uint8_t cmd, unsigned int delay)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_TCKH);	/* Setup time */
+		delay_bit_us(DELAY_TCKH);	/* Setup time */
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_TCKL);	/* Hold time */
+		delay_bit_us(DELAY_TCKL);	/* Hold time */
 	}
 	GPIO_CLR(pic_data);
 	delay_us(delay);
@@ -121,14 +121,16 @@ uint16_t pic10f322::read_data(void)
 
 	GPIO_IN(pic_data);
 
+	gang_word_begin();
 	for (i = 0; i < 16; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_TCKH);
+		delay_bit_us(DELAY_TCKH);
 		delay_us(DELAY_TCO);	/* Wait for data to be valid */
 		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_TCKL);
+		delay_bit_us(DELAY_TCKL);
 	}
+	gang_word_end();
 
 	GPIO_IN(pic_data);
 	GPIO_OUT(pic_data);
@@ -148,9 +150,9 @@ void pic10f322::write_data(uint16_t data)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_SETUP);	/* Setup time */
+		delay_bit_us(DELAY_SETUP);	/* Setup time */
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_HOLD);	/* Hold time */
+		delay_bit_us(DELAY_HOLD);	/* Hold time */
 	}
 	GPIO_CLR(pic_data);
 }
@@ -184,9 +186,7 @@ bool pic10f322::read_device_id(void)
 
 			strcpy(name,piclist[i].name);
 			mem.code_memory_size = piclist[i].code_memory_size;
-			mem.program_memory_size = 0x0F80018;
-			mem.location = (uint16_t*) calloc(mem.program_memory_size,sizeof(uint16_t));
-			mem.filled = (bool*) calloc(mem.program_memory_size,sizeof(bool));
+			mem.init(0x0F80018);
 			found = 1;
 			break;
 		}
@@ -219,10 +219,11 @@ uint8_t pic10f322::blank_check(void)
 
 	for(addr = 0; addr < mem.code_memory_size; addr++){
 		send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+		gang_expect(addr, 0x3FFF << 1, 0x3FFF << 1);
 		data = read_data() & 0x3FFF;
 		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
 
-		if(data != 0x3FFF) {
+		if(data != 0x3FFF && gang_targets() == 1) {
 			fprintf(stderr, "Chip not Blank! Address: 0x%x, Read: 0x%x.\n",  addr, data);
 			ret = 1;
 			break;
@@ -283,9 +284,10 @@ void pic10f322::bulk_erase(void)
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
+bool pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint16_t addr, data = 0x0000;
+	hex_sink sink(outfile, mem.program_memory_size);
 
 	if(!flags.debug) cerr << "[ 0%]";
 	if(flags.client) fprintf(stdout, "@000");
@@ -304,8 +306,7 @@ void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 			fprintf(stderr, "  addr = 0x%04X  data = 0x%04X\n", addr, data);
 
 		if (data != 0x3FFF) {
-			mem.location[addr]        = data;
-			mem.filled[addr]      = 1;
+			sink.put(addr, data);
 		}
 
 		if(lcounter != addr*100/mem.code_memory_size){
@@ -336,8 +337,7 @@ void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 		fprintf(stderr, "  addr = 0x%04X  data = 0x%04X\n", addr, data);
 
 	if (data != 0x3FFF) {
-		mem.location[addr]        = data;
-		mem.filled[addr]      = 1;
+		sink.put(addr, data);
 	}
 	/* Config Word 2 */
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826)){
@@ -356,14 +356,13 @@ void pic10f322::read(char *outfile, uint32_t start, uint32_t count)
 			fprintf(stderr, "  addr = 0x%04X  data = 0x%04X\n", addr, data);
 
 		if (data != mask) {
-			mem.location[addr]        = data;
-			mem.filled[addr]      = 1;
+			sink.put(addr, data);
 		}
 	}
 
 	if(!flags.debug) cerr << "\b\b\b\b\b";
 	if(flags.client) fprintf(stdout, "@FIN");
-	write_inhx(&mem, outfile);
+	return sink.close();
 }
 
 /* Bulk erase the chip, and then write contents of the .hex file to the PIC */
@@ -385,15 +384,21 @@ void pic10f322::write(char *infile)
 
 	for (addr = 0; addr < mem.code_memory_size; addr += latch_size){        /* address in WORDS (2 Bytes) */
 
+		/* the address can only be incremented: step over rows without data */
+		if (mem.next_row(addr, latch_size) != addr) {
+			for (i = 0; i < latch_size; i++)
+				send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+			continue;
+		}
 
 		if (flags.debug)
 			fprintf(stderr, "Current address 0x%08X \n", addr);
 		for(i=0; i<latch_size-1; i++){		                        /* write the first 62 bytes */
-			if (mem.filled[addr+i]) {
+			if (mem.filled(addr+i)) {
 				if (flags.debug)
-					fprintf(stderr, "  Writing 0x%04X to address 0x%06X \n", mem.location[addr + i], (addr+i) );
+					fprintf(stderr, "  Writing 0x%04X to address 0x%06X \n", mem.get(addr + i), (addr+i) );
 				send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
-				write_data(mem.location[addr+i]);
+				write_data(mem.get(addr+i));
 			}
 			else {
 				if (flags.debug)
@@ -405,11 +410,11 @@ void pic10f322::write(char *infile)
 		}
 
 		/* write the last 2 bytes and start programming */
-		if (mem.filled[addr+latch_size-1]) {
+		if (mem.filled(addr+latch_size-1)) {
 			if (flags.debug)
-				fprintf(stderr, "  Writing 0x%04X to address 0x%06X and then start programming...\n", mem.location[addr+latch_size-1], (addr+latch_size-1));
+				fprintf(stderr, "  Writing 0x%04X to address 0x%06X and then start programming...\n", mem.get(addr+latch_size-1), (addr+latch_size-1));
 			send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
-			write_data(mem.location[addr+latch_size-1]);
+			write_data(mem.get(addr+latch_size-1));
 		}
 		else {
 			if (flags.debug)
@@ -449,9 +454,9 @@ void pic10f322::write(char *infile)
 		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
 		addr++;
 	}
-	if(mem.filled[addr]){
+	if(mem.filled(addr)){
 		send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
-		write_data(mem.location[addr]);
+		write_data(mem.get(addr));
 
 		send_cmd(COMM_BEGIN_IN_TIMED_PROG, DELAY_TPINT_CONF);
 	}
@@ -459,9 +464,9 @@ void pic10f322::write(char *infile)
 	if((detailed_subfamily == SF_PIC12F1822) || (detailed_subfamily == SF_PIC16LF1826)){
 		addr++;
 		send_cmd(COMM_INC_ADDR, DELAY_TDLY);
-		if(mem.filled[addr]){
+		if(mem.filled(addr)){
 			send_cmd(COMM_LOAD_FOR_PROG, DELAY_TDLY);
-			write_data(mem.location[addr]);
+			write_data(mem.get(addr));
 
 			send_cmd(COMM_BEGIN_IN_TIMED_PROG, DELAY_TPINT_CONF);
 		}
@@ -475,17 +480,25 @@ void pic10f322::write(char *infile)
 		reset_mem_location();
 
 		for (addr = 0; addr < mem.code_memory_size; addr++) {
+			/* only the locations holding data are read back */
+			if (!mem.filled(addr)) {
+				send_cmd(COMM_INC_ADDR, DELAY_TDLY);
+				continue;
+			}
+
 			send_cmd(COMM_READ_FROM_PROG, DELAY_TDLY);
+			gang_expect(addr, mem.get(addr) << 1, 0x3FFF << 1);
 			data = read_data() & 0x3FFF;
 			send_cmd(COMM_INC_ADDR, DELAY_TDLY);
 
 			if (flags.debug)
 				fprintf(stderr, "addr = 0x%06X:  pic = 0x%04X, file = 0x%04X\n",
-						addr, data, (mem.filled[addr]) ? (mem.location[addr]) : 0x3FFF);
+						addr, data, (mem.filled(addr)) ? (mem.get(addr)) : 0x3FFF);
 
-			if ( (data != mem.location[addr]) & ( mem.filled[addr]) ) {
+			if ( (data != mem.get(addr)) & ( mem.filled(addr)) &&
+					gang_targets() == 1) {
 				fprintf(stderr, "Error at addr = 0x%06X:  pic = 0x%04X, file = 0x%04X.\nExiting...",
-						addr, data, mem.location[addr]);
+						addr, data, mem.get(addr));
 				return;
 			}
 			if(lcounter != addr*100/mem.code_memory_size){
@@ -519,10 +532,10 @@ void pic10f322::write(char *infile)
 			mask = 0x3EFF;
 
 		data = read_data() & mask;
-		fileconf = mem.location[addr] & mask;
-		if ( ( data != fileconf ) & ( mem.filled[addr] ) ) {
+		fileconf = mem.get(addr) & mask;
+		if ( ( data != fileconf ) & ( mem.filled(addr) ) ) {
 			fprintf(stderr, "Error at addr = 0x%06X:  pic = 0x%04X, file = 0x%04X.\nExiting...",
-					addr, data, mem.location[addr] & mask);
+					addr, data, mem.get(addr) & mask);
 			return;
 		}
 
@@ -540,10 +553,10 @@ void pic10f322::write(char *infile)
 			/* Ignore LVP bit. */
 			mask &= ~(1 << 13);
 			data = read_data() & mask;
-			fileconf = mem.location[addr] & mask;
-			if ( ( data != fileconf ) & ( mem.filled[addr] ) ) {
+			fileconf = mem.get(addr) & mask;
+			if ( ( data != fileconf ) & ( mem.filled(addr) ) ) {
 				fprintf(stderr, "Error at addr = 0x%06X:  pic = 0x%04X, file = 0x%04X.\nExiting...",
-						addr, data & mask, mem.location[addr] & mask);
+						addr, data & mask, mem.get(addr) & mask);
 				return;
 			}
 		}
@@ -49,7 +49,7 @@ class pic10f322: public Pic{
 		bool read_device_id(void);
 		void bulk_erase(void);
 		void dump_configuration_registers(void);
-		void read(char *outfile, uint32_t start, uint32_t count);
+		bool read(char *outfile, uint32_t start, uint32_t count);
 		void write(char *infile);
 		uint8_t blank_check(void);
 		void write_user_id(uint64_t){};
@@ -83,9 +83,9 @@ void pic18fj::enter_program_mode(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
+		delay_bit_us(DELAY_P2B);	/* Setup time */
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
+		delay_bit_us(DELAY_P2A);	/* Hold time */
 		GPIO_CLR(pic_clk);
 
 	}
@@ -118,9 +118,9 @@ void pic18fj::send_cmd(uint8_t cmd)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
+		delay_bit_us(DELAY_P2B);	/* Setup time */
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
+		delay_bit_us(DELAY_P2A);	/* Hold time */
 	}
 	GPIO_CLR(pic_data);
 	delay_us(DELAY_P5);
@@ -134,23 +134,25 @@ uint16_t pic18fj::read_data(void)
 
 	for (i = 0; i < 8; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P2B);
+		delay_bit_us(DELAY_P2B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);
+		delay_bit_us(DELAY_P2A);
 	}
 
 	delay_us(DELAY_P6);	/* wait for the data... */
 
 	GPIO_IN(pic_data);
 
+	gang_word_begin();
 	for (i = 0; i < 8; i++) {
 		GPIO_SET(pic_clk);
 		delay_us(DELAY_P14);	/* Wait for data to be valid */
 		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
-		delay_us(DELAY_P2B);
+		delay_bit_us(DELAY_P2B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);
+		delay_bit_us(DELAY_P2A);
 	}
+	gang_word_end();
 
 	delay_us(DELAY_P5A);
 	GPIO_IN(pic_data);
@@ -169,9 +171,9 @@ void pic18fj::write_data(uint16_t data)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
+		delay_bit_us(DELAY_P2B);	/* Setup time */
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
+		delay_bit_us(DELAY_P2A);	/* Hold time */
 	}
 	GPIO_CLR(pic_data);
 	delay_us(DELAY_P5A);
@@ -218,9 +220,7 @@ bool pic18fj::read_device_id(void)
 
 			strcpy(name,piclist[i].name);
 			mem.code_memory_size = piclist[i].code_memory_size;
-			mem.program_memory_size = 0x0F80018;
-			mem.location = (uint16_t*) calloc(mem.program_memory_size,sizeof(uint16_t));
-			mem.filled = (bool*) calloc(mem.program_memory_size,sizeof(bool));
+			mem.init(0x0F80018);
 			found = 1;
 			break;
 		}
@@ -242,12 +242,14 @@ uint8_t pic18fj::blank_check(void)
 
 	for(addr = 0; addr < (mem.code_memory_size - 4); addr++){
 
+		gang_expect(addr*2, 0xFF, 0xFF);
+		gang_expect(addr*2+1, 0xFF, 0xFF);
 		send_cmd(COMM_TABLE_READ_POST_INC);
 		data = read_data();
 		send_cmd(COMM_TABLE_READ_POST_INC);
 		data = (read_data() << 8) | (data & 0xFF) ;
 
-		if(data != 0xFFFF) {
+		if(data != 0xFFFF && gang_targets() == 1) {
 			fprintf(stderr, "Chip not Blank! Address: 0x%d, Read: 0x%x.\n",  addr*2, data);
 			ret = 1;
 			break;
@@ -283,9 +285,10 @@ void pic18fj::bulk_erase(void)
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void pic18fj::read(char *outfile, uint32_t start, uint32_t count)
+bool pic18fj::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint16_t addr, data = 0x0000;
+	hex_sink sink(outfile, mem.program_memory_size);
 
 	if(!flags.debug) cerr << "[ 0%]";
 	if(flags.client) fprintf(stdout, "@000");
@@ -306,8 +309,7 @@ void pic18fj::read(char *outfile, uint32_t start, uint32_t count)
 			fprintf(stderr, "  addr = 0x%04X  data = 0x%04X\n", addr*2, data);
 
 		if (data != 0xFFFF) {
-			mem.location[addr]        = data;
-			mem.filled[addr]      = 1;
+			sink.put(addr, data);
 		}
 
 		if(lcounter != addr*100/mem.code_memory_size){
@@ -321,7 +323,7 @@ void pic18fj::read(char *outfile, uint32_t start, uint32_t count)
 
 	if(!flags.debug) cerr << "\b\b\b\b\b";
 	if(flags.client) fprintf(stdout, "@FIN");
-	write_inhx(&mem, outfile);
+	return sink.close();
 }
 
 /* Bulk erase the chip, and then write contents of the .hex file to the PIC */
@@ -329,8 +331,9 @@ void pic18fj::write(char *infile)
 {
 	int i;
 	uint16_t data;
-	uint32_t addr = 0x00000000;
+	uint32_t addr = 0x00000000, row;
 	unsigned int filled_locations=1;
+	bool error = false;
 
 	filled_locations = read_inhx(infile, &mem);
 
@@ -343,18 +346,19 @@ void pic18fj::write(char *infile)
 	send_cmd(COMM_CORE_INSTRUCTION);
 	write_data(0x84A6);			/* enable writes */
 
-	for (addr = 0; addr < mem.code_memory_size; addr += 32){        /* address in WORDS (2 Bytes) */
+	for (addr = mem.next_row(0, 32); addr < mem.code_memory_size;
+			addr = mem.next_row(addr + 32, 32)){        /* address in WORDS (2 Bytes) */
 
 		goto_mem_location(2*addr);
 		if (flags.debug)
 			fprintf(stderr, "Go to address 0x%08X \n", addr);
 
 		for(i=0; i<31; i++){		                        /* write the first 62 bytes */
-			if (mem.filled[addr+i]) {
+			if (mem.filled(addr+i)) {
 				if (flags.debug)
-					fprintf(stderr, "  Writing 0x%04X to address 0x%06X \n", mem.location[addr + i], (addr+i)*2 );
+					fprintf(stderr, "  Writing 0x%04X to address 0x%06X \n", mem.get(addr + i), (addr+i)*2 );
 				send_cmd(COMM_TABLE_WRITE_POST_INC_2);
-				write_data(mem.location[addr+i]);
+				write_data(mem.get(addr+i));
 			}
 			else {
 				if (flags.debug)
@@ -365,11 +369,11 @@ void pic18fj::write(char *infile)
 		}
 
 		/* write the last 2 bytes and start programming */
-		if (mem.filled[addr+31]) {
+		if (mem.filled(addr+31)) {
 			if (flags.debug)
-				fprintf(stderr, "  Writing 0x%04X to address 0x%06X and then start programming...\n", mem.location[addr+31], (addr+31)*2);
+				fprintf(stderr, "  Writing 0x%04X to address 0x%06X and then start programming...\n", mem.get(addr+31), (addr+31)*2);
 			send_cmd(COMM_TABLE_WRITE_STARTP);
-			write_data(mem.location[addr+31]);
+			write_data(mem.get(addr+31));
 		}
 		else {
 			if (flags.debug)
@@ -382,9 +386,9 @@ void pic18fj::write(char *infile)
 		GPIO_CLR(pic_data);
 		for (i = 0; i < 3; i++) {
 			GPIO_SET(pic_clk);
-			delay_us(DELAY_P2B);       /* Setup time */
+			delay_bit_us(DELAY_P2B);       /* Setup time */
 			GPIO_CLR(pic_clk);
-			delay_us(DELAY_P2A);       /* Hold time */
+			delay_bit_us(DELAY_P2A);       /* Hold time */
 		}
 		GPIO_SET(pic_clk);
 		delay_us(DELAY_P9);        /* Programming time */
@@ -410,30 +414,42 @@ void pic18fj::write(char *infile)
 		if(flags.client) fprintf(stdout, "@000");
 		lcounter = 0;
 
-		goto_mem_location(0x000000);
+		addr = 0xFFFFFFFF;
+		for (row = mem.next_row(0, 32); row < mem.code_memory_size && !error;
+				row = mem.next_row(row + 32, 32)) {
 
-		for (addr = 0; addr < mem.code_memory_size; addr++) {
+			/* the table pointer only needs to be moved over skipped rows */
+			if (row != addr)
+				goto_mem_location(2*row);
 
-			send_cmd(COMM_TABLE_READ_POST_INC);
-			data = read_data();
-			send_cmd(COMM_TABLE_READ_POST_INC);
-			data = ( read_data() << 8 ) | ( data & 0xFF );
+			for (addr = row; addr < row + 32 && addr < mem.code_memory_size; addr++) {
+				gang_expect(addr*2, mem.get(addr) & 0xFF,
+						mem.filled(addr) ? 0xFF : 0);
+				gang_expect(addr*2+1, mem.get(addr) >> 8,
+						mem.filled(addr) ? 0xFF : 0);
+				send_cmd(COMM_TABLE_READ_POST_INC);
+				data = read_data();
+				send_cmd(COMM_TABLE_READ_POST_INC);
+				data = ( read_data() << 8 ) | ( data & 0xFF );
 
-			if (flags.debug)
-				fprintf(stderr, "addr = 0x%06X:  pic = 0x%04X, file = 0x%04X\n",
-						addr*2, data, (mem.filled[addr]) ? (mem.location[addr]) : 0xFFFF);
-
-			if ( (data != mem.location[addr]) & ( mem.filled[addr]) ) {
-				fprintf(stderr, "Error at addr = 0x%06X:  pic = 0x%04X, file = 0x%04X.\nExiting...",
-						addr*2, data, mem.location[addr]);
-				break;
-			}
-			if(lcounter != addr*100/filled_locations){
-				lcounter = addr*100/filled_locations;
-				if(flags.client)
-					fprintf(stdout,"@%03d", lcounter);
-				if(!flags.debug)
-					fprintf(stderr,"\b\b\b\b\b[%2d%%]", lcounter);
+				if (flags.debug)
+					fprintf(stderr, "addr = 0x%06X:  pic = 0x%04X, file = 0x%04X\n",
+							addr*2, data, (mem.filled(addr)) ? (mem.get(addr)) : 0xFFFF);
+
+				if ( (data != mem.get(addr)) & ( mem.filled(addr)) &&
+						gang_targets() == 1) {
+					fprintf(stderr, "Error at addr = 0x%06X:  pic = 0x%04X, file = 0x%04X.\nExiting...",
+							addr*2, data, mem.get(addr));
+					error = true;
+					break;
+				}
+				if(lcounter != addr*100/filled_locations){
+					lcounter = addr*100/filled_locations;
+					if(flags.client)
+						fprintf(stdout,"@%03d", lcounter);
+					if(!flags.debug)
+						fprintf(stderr,"\b\b\b\b\b[%2d%%]", lcounter);
+				}
 			}
 		}
 
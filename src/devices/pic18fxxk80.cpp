@@ -114,9 +114,9 @@ void pic18fxxk80::enter_program_mode(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
+		delay_bit_us(DELAY_P2B);	/* Setup time */
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
+		delay_bit_us(DELAY_P2A);	/* Hold time */
 		GPIO_CLR(pic_clk);
 
 	}
@@ -149,9 +149,9 @@ void pic18fxxk80::send_cmd(uint8_t cmd)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
+		delay_bit_us(DELAY_P2B);	/* Setup time */
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
+		delay_bit_us(DELAY_P2A);	/* Hold time */
 	}
 	GPIO_CLR(pic_data);
 	delay_us(DELAY_P5);
@@ -165,23 +165,25 @@ uint16_t pic18fxxk80::read_data(void)
 
 	for (i = 0; i < 8; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P2B);
+		delay_bit_us(DELAY_P2B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);
+		delay_bit_us(DELAY_P2A);
 	}
 
 	delay_us(DELAY_P6);	/* wait for the data... */
 
 	GPIO_IN(pic_data);
 
+	gang_word_begin();
 	for (i = 0; i < 8; i++) {
 		GPIO_SET(pic_clk);
 		delay_us(DELAY_P14);	/* Wait for data to be valid */
 		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
-		delay_us(DELAY_P2B);
+		delay_bit_us(DELAY_P2B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);
+		delay_bit_us(DELAY_P2A);
 	}
+	gang_word_end();
 
 	delay_us(DELAY_P5A);
 	GPIO_IN(pic_data);
@@ -200,9 +202,9 @@ void pic18fxxk80::write_data(uint16_t data)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P2B);	/* Setup time */
+		delay_bit_us(DELAY_P2B);	/* Setup time */
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);	/* Hold time */
+		delay_bit_us(DELAY_P2A);	/* Hold time */
 	}
 	GPIO_CLR(pic_data);
 	delay_us(DELAY_P5A);
@@ -258,9 +260,7 @@ bool pic18fxxk80::read_device_id(void)
 		if (piclist[i].device_id == device_id) {
 			strcpy(name,piclist[i].name);
 			mem.code_memory_size = piclist[i].code_memory_size;
-			mem.program_memory_size = 0x3FFFFF;
-			mem.location = (uint16_t*) calloc(mem.program_memory_size, sizeof(uint16_t));
-			mem.filled = (bool*) calloc(mem.program_memory_size, sizeof(bool));
+			mem.init(0x3FFFFF);
 			write_buffer_size = piclist[i].write_buffer_size;
 			block_count = piclist[i].block_count;
 			found = 1;
@@ -283,12 +283,14 @@ uint8_t pic18fxxk80::blank_check(void)
 	goto_mem_location(0x000000);
 
 	for (addr = 0; (2*addr) < mem.code_memory_size; addr++) {
+		gang_expect(addr*2, 0xFF, 0xFF);
+		gang_expect(addr*2+1, 0xFF, 0xFF);
 		send_cmd(COMM_TABLE_READ_POST_INC);
 		data = read_data();
 		send_cmd(COMM_TABLE_READ_POST_INC);
 		data = (read_data() << 8) | (data & 0xFF) ;
 
-		if (data != 0xFFFF) {
+		if (data != 0xFFFF && gang_targets() == 1) {
 			fprintf(stderr, "Chip not Blank! Address: 0x%x, Read: 0x%x.\n",  addr*2, data);
 			ret = 1;
 			break;
@@ -501,10 +503,11 @@ void pic18fxxk80::eeprom_erase()
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void pic18fxxk80::read(char *outfile, uint32_t start, uint32_t count)
+bool pic18fxxk80::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint16_t addr, data = 0x0000;
 	unsigned int lcounter = 0;
+	hex_sink sink(outfile, mem.program_memory_size);
 
 	if (!flags.debug) cerr << "[ 0%]";
 	if (flags.client) fprintf(stdout, "@000");
@@ -523,8 +526,7 @@ void pic18fxxk80::read(char *outfile, uint32_t start, uint32_t count)
 			fprintf(stderr, "  addr = 0x%04X  data = 0x%04X\n", addr*2, data);
 
 		if (data != 0xFFFF) {
-			mem.location[addr] = data;
-			mem.filled[addr] = 1;
+			sink.put(addr, data);
 		}
 
 		if (lcounter != 2*addr*100/mem.code_memory_size) {
@@ -538,7 +540,7 @@ void pic18fxxk80::read(char *outfile, uint32_t start, uint32_t count)
 
 	if (!flags.debug) cerr << "\b\b\b\b\b";
 	if (flags.client) fprintf(stdout, "@FIN");
-	write_inhx(&mem, outfile);
+	return sink.close();
 }
 
 void pic18fxxk80::programming_sequence(bool cfg_word)
@@ -548,9 +550,9 @@ void pic18fxxk80::programming_sequence(bool cfg_word)
 	GPIO_CLR(pic_data);
 	for (i = 0; i < 3; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P2B);       /* Setup time */
+		delay_bit_us(DELAY_P2B);       /* Setup time */
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P2A);       /* Hold time */
+		delay_bit_us(DELAY_P2A);       /* Hold time */
 	}
 	GPIO_SET(pic_clk);
 
@@ -568,8 +570,9 @@ void pic18fxxk80::write_code()
 {
 	int i;
 	uint16_t data;
-	uint32_t addr = 0x00000000;
+	uint32_t addr = 0x00000000, next = 0xFFFFFFFF, row;
 	unsigned int lcounter;
+	bool error = false;
 
 	if(!flags.debug) cerr << "[ 0%]";
 	if(flags.client) fprintf(stdout, "@000");
@@ -580,14 +583,18 @@ void pic18fxxk80::write_code()
 	send_instruction(COMM_CORE_INSTRUCTION, 0x9c7f);	/* BCF EECON1, CFGS */
 	send_instruction(COMM_CORE_INSTRUCTION, 0x847f);	/* BSF EECON1, WREN */
 
-	goto_mem_location(0);
+	for (addr = mem.next_row(0, write_buffer_size/2); (addr*2) < mem.code_memory_size;
+			addr = mem.next_row(addr + write_buffer_size/2, write_buffer_size/2)) {        /* address in WORDS (2 Bytes) */
+		/* the table pointer only needs to be moved over skipped rows */
+		if (addr != next)
+			goto_mem_location(2*addr);
+		next = addr + write_buffer_size/2;
 
-	for (addr = 0; (addr*2) < mem.code_memory_size; addr += write_buffer_size/2) {        /* address in WORDS (2 Bytes) */
 		for (i=0; i<(write_buffer_size/2-1); i++) {		                        /* write all but the last word */
-			if (mem.filled[addr+i]) {
+			if (mem.filled(addr+i)) {
 				if (flags.debug)
-					fprintf(stderr, "  Writing 0x%04X to address 0x%06X \n", mem.location[addr + i], (addr+i)*2 );
-				send_instruction(COMM_TABLE_WRITE_POST_INC_2, mem.location[addr+i]);
+					fprintf(stderr, "  Writing 0x%04X to address 0x%06X \n", mem.get(addr + i), (addr+i)*2 );
+				send_instruction(COMM_TABLE_WRITE_POST_INC_2, mem.get(addr+i));
 			} else {
 				if (flags.debug)
 					fprintf(stderr, "  Writing 0xFFFF to address 0x%06X \n", (addr+i)*2 );
@@ -596,10 +603,10 @@ void pic18fxxk80::write_code()
 		}
 
 		/* write the last word (2 bytes) and start programming */
-		if (mem.filled[addr+(write_buffer_size/2-1)]) {
+		if (mem.filled(addr+(write_buffer_size/2-1))) {
 			if (flags.debug)
-				fprintf(stderr, "  Writing 0x%04X to address 0x%06X and then start programming...\n", mem.location[addr+(write_buffer_size/2-1)], (addr+(write_buffer_size/2-1))*2);
-			send_instruction(COMM_TABLE_WRITE_STARTP_POST_INC_2, mem.location[addr+(write_buffer_size/2-1)]);
+				fprintf(stderr, "  Writing 0x%04X to address 0x%06X and then start programming...\n", mem.get(addr+(write_buffer_size/2-1)), (addr+(write_buffer_size/2-1))*2);
+			send_instruction(COMM_TABLE_WRITE_STARTP_POST_INC_2, mem.get(addr+(write_buffer_size/2-1)));
 		} else {
 			if (flags.debug)
 				fprintf(stderr, "  Writing 0xFFFF to address 0x%06X and then start programming...\n", (addr+(write_buffer_size/2-1))*2);
@@ -627,29 +634,41 @@ void pic18fxxk80::write_code()
 		if(flags.client) fprintf(stdout, "@000");
 		lcounter = 0;
 
-		goto_mem_location(0x000000);
+		addr = 0xFFFFFFFF;
+		for (row = mem.next_row(0, write_buffer_size/2); (row*2) < mem.code_memory_size && !error;
+				row = mem.next_row(row + write_buffer_size/2, write_buffer_size/2)) {
 
-		for (addr = 0; (addr*2) < mem.code_memory_size; addr++) {
-			send_cmd(COMM_TABLE_READ_POST_INC);
-			data = read_data();
-			send_cmd(COMM_TABLE_READ_POST_INC);
-			data = ( read_data() << 8 ) | ( data & 0xFF );
+			if (row != addr)
+				goto_mem_location(2*row);
 
-			if (flags.debug)
-				fprintf(stderr, "addr = 0x%06X:  pic = 0x%04X, file = 0x%04X\n",
-						addr*2, data, (mem.filled[addr]) ? (mem.location[addr]) : 0xFFFF);
+			for (addr = row; addr < row + write_buffer_size/2 && (addr*2) < mem.code_memory_size; addr++) {
+				gang_expect(addr*2, mem.get(addr) & 0xFF,
+						mem.filled(addr) ? 0xFF : 0);
+				gang_expect(addr*2+1, mem.get(addr) >> 8,
+						mem.filled(addr) ? 0xFF : 0);
+				send_cmd(COMM_TABLE_READ_POST_INC);
+				data = read_data();
+				send_cmd(COMM_TABLE_READ_POST_INC);
+				data = ( read_data() << 8 ) | ( data & 0xFF );
 
-			if ((data != mem.location[addr]) & ( mem.filled[addr])) {
-				fprintf(stderr, "Error at addr = 0x%06X:  pic = 0x%04X, file = 0x%04X.\nExiting...",
-						addr*2, data, mem.location[addr]);
-				break;
-			}
-			if (lcounter != addr*2*100/mem.code_memory_size) {
-				lcounter = addr*2*100/mem.code_memory_size;
-				if(flags.client)
-					fprintf(stdout,"@%03d", lcounter);
-				if(!flags.debug)
-					fprintf(stderr,"\b\b\b\b\b[%2d%%]", lcounter);
+				if (flags.debug)
+					fprintf(stderr, "addr = 0x%06X:  pic = 0x%04X, file = 0x%04X\n",
+							addr*2, data, (mem.filled(addr)) ? (mem.get(addr)) : 0xFFFF);
+
+				if ((data != mem.get(addr)) & ( mem.filled(addr)) &&
+						gang_targets() == 1) {
+					fprintf(stderr, "Error at addr = 0x%06X:  pic = 0x%04X, file = 0x%04X.\nExiting...",
+							addr*2, data, mem.get(addr));
+					error = true;
+					break;
+				}
+				if (lcounter != addr*2*100/mem.code_memory_size) {
+					lcounter = addr*2*100/mem.code_memory_size;
+					if(flags.client)
+						fprintf(stdout,"@%03d", lcounter);
+					if(!flags.debug)
+						fprintf(stderr,"\b\b\b\b\b[%2d%%]", lcounter);
+				}
 			}
 		}
 
@@ -720,19 +739,19 @@ void pic18fxxk80::configuration_register_write(uint8_t reg, uint16_t data)
 void pic18fxxk80::write_configuration_registers()
 {
 	for (int i=0; i<8; i++) {
-		if (mem.filled[LOCATION_CONFIG / 2 + i])
-			configuration_register_write(i, mem.location[LOCATION_CONFIG / 2 + i]);
+		if (mem.filled(LOCATION_CONFIG / 2 + i))
+			configuration_register_write(i, mem.get(LOCATION_CONFIG / 2 + i));
 		else
 			printf("Skipping configuration register %d\n", i);
 	}
 
 	if(!flags.noverify) {
 		for (int i=0; i<8; i++) {
-			if (mem.filled[LOCATION_CONFIG / 2 + i]) {
+			if (mem.filled(LOCATION_CONFIG / 2 + i)) {
 				uint16_t devreg = configuration_register_read(i);
-				if (mem.location[LOCATION_CONFIG / 2 + i] != devreg) {
+				if (mem.get(LOCATION_CONFIG / 2 + i) != devreg) {
 					fprintf(stderr, "Failed to write config register at addr = 0x%06X:  pic = 0x%04X, file = 0x%04X.\n",
-							LOCATION_CONFIG+2*i, devreg, mem.location[LOCATION_CONFIG / 2 + i]);
+							LOCATION_CONFIG+2*i, devreg, mem.get(LOCATION_CONFIG / 2 + i));
 				}
 			}
 		}
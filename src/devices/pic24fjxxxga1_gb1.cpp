@@ -25,31 +25,31 @@
 
 #include "pic24fjxxxga1_gb1.h"
 
-/* delays (in microseconds; nanoseconds are rounded to 1us) */
-#define DELAY_P1   			1		// 100ns
-#define DELAY_P1A			1		// 40ns
-#define DELAY_P1B			1		// 40ns
-#define DELAY_P2			1		// 15ns
-#define DELAY_P3			1		// 15ns
-#define DELAY_P4			1		// 40ns
-#define DELAY_P4A			1		// 40ns
-#define DELAY_P5			1		// 20ns
-#define DELAY_P6			1		// 100ns
-#define DELAY_P7			25000		// 25ms
-#define DELAY_P8			12		// 12us
-#define DELAY_P9			40		// 40us
-#define DELAY_P10			1		// 400ns
-#define DELAY_P11			400000		// 400ms
-#define DELAY_P12			40000		// 40ms
-#define DELAY_P13			2000		// 2ms
-#define DELAY_P14			1		// 1us MAX!
-#define DELAY_P15			1		// 10ns
+/* delays (in nanoseconds) */
+#define DELAY_P1   			100		// 100ns
+#define DELAY_P1A			40		// 40ns
+#define DELAY_P1B			40		// 40ns
+#define DELAY_P2			15		// 15ns
+#define DELAY_P3			15		// 15ns
+#define DELAY_P4			40		// 40ns
+#define DELAY_P4A			40		// 40ns
+#define DELAY_P5			20		// 20ns
+#define DELAY_P6			100		// 100ns
+#define DELAY_P7			25000000		// 25ms
+#define DELAY_P8			12000		// 12us
+#define DELAY_P9			40000		// 40us
+#define DELAY_P10			400		// 400ns
+#define DELAY_P11			400000000		// 400ms
+#define DELAY_P12			40000000		// 40ms
+#define DELAY_P13			2000000		// 2ms
+#define DELAY_P14			1000		// 1us MAX!
+#define DELAY_P15			10		// 10ns
 #define DELAY_P16			0		// 0s
 #define DELAY_P17   			0		// 0s
-#define DELAY_P18			1		// 40ns
-#define DELAY_P19			1000		// 1ms
-#define DELAY_P20			23		// 23us
-#define DELAY_P21			1		// 8ns
+#define DELAY_P18			40		// 40ns
+#define DELAY_P19			1000000		// 1ms
+#define DELAY_P20			23000		// 23us
+#define DELAY_P21			8		// 8ns
 
 #define ENTER_PROGRAM_KEY	0x4D434851
 
@@ -69,12 +69,12 @@ void pic24fjxxxga1_gb1::send_cmd(uint32_t cmd)
 	/* send the SIX = 0x0000 instruction */
 	for (i = 0; i < 4; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(DELAY_P4);
 
 	/* send the 24-bit command */
 	for (i = 0; i < 24; i++) {
@@ -82,13 +82,13 @@ void pic24fjxxxga1_gb1::send_cmd(uint32_t cmd)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 	}
 
-	delay_us(DELAY_P4A);
+	delay_ns(DELAY_P4A);
 }
 
 /* Read 16-bit data word from the PIC (LSB first) through a REGOUT inst */
@@ -106,36 +106,38 @@ uint16_t pic24fjxxxga1_gb1::read_data(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 	}
 
-	delay_us(DELAY_P4);
+	delay_ns(DELAY_P4);
 
 	/* idle for 8 clock cycles, waiting for the data to be ready */
 	for (i = 0; i < 8; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
 
-	delay_us(DELAY_P5);
+	delay_ns(DELAY_P5);
 
 	GPIO_IN(pic_data);
 
 	/* read a 16-bit data word */
+	gang_word_begin();
 	for (i = 0; i < 16; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		data |= ( GPIO_LEV(pic_data) & 0x00000001 ) << i;
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 	}
+	gang_word_end();
 
-	delay_us(DELAY_P4A);
+	delay_ns(DELAY_P4A);
 	GPIO_OUT(pic_data);
 	return data;
 }
@@ -151,11 +153,11 @@ void pic24fjxxxga1_gb1::enter_program_mode(void)
 	GPIO_CLR(pic_clk);
 
 	GPIO_CLR(pic_mclr);		/*  remove VDD from MCLR pin */
-	delay_us(DELAY_P6);
+	delay_ns(DELAY_P6);
 	GPIO_SET(pic_mclr);		/*  apply VDD to MCLR pin */
-	delay_us(DELAY_P21);
+	delay_ns(DELAY_P21);
 	GPIO_CLR(pic_mclr);		/* remove VDD from MCLR pin */
-	delay_us(DELAY_P18);
+	delay_ns(DELAY_P18);
 
 	/* Shift in the "enter program mode" key sequence (MSB first) */
 	for (i = 31; i > -1; i--) {
@@ -163,17 +165,17 @@ void pic24fjxxxga1_gb1::enter_program_mode(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 		GPIO_CLR(pic_clk);
 
 	}
 
 	GPIO_CLR(pic_data);
-	delay_us(DELAY_P19);
+	delay_ns(DELAY_P19);
 	GPIO_SET(pic_mclr);
-	delay_us(DELAY_P7);
+	delay_ns(DELAY_P7);
 
 	/*
 	 * Coming out of Reset, ther first 4-bit control code is always forced
@@ -183,9 +185,9 @@ void pic24fjxxxga1_gb1::enter_program_mode(void)
 	 */
 	for (i = 0; i < 5; i++) {
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1A);
+		delay_bit_ns(DELAY_P1A);
 		GPIO_CLR(pic_clk);
-		delay_us(DELAY_P1B);
+		delay_bit_ns(DELAY_P1B);
 	}
 }
 
@@ -194,9 +196,9 @@ void pic24fjxxxga1_gb1::exit_program_mode(void)
 {
 	GPIO_CLR(pic_clk);
 	GPIO_CLR(pic_data);
-	delay_us(DELAY_P16);
+	delay_ns(DELAY_P16);
 	GPIO_CLR(pic_mclr);	/* remove VDD from MCLR pin */
-	delay_us(DELAY_P17);	/* wait (at least) P17 */
+	delay_ns(DELAY_P17);	/* wait (at least) P17 */
 	GPIO_IN(pic_mclr);
 }
 
@@ -254,9 +256,7 @@ bool pic24fjxxxga1_gb1::read_device_id(void)
 		if (piclist[i].device_id == device_id) {
 			strcpy(name, piclist[i].name);
 			mem.code_memory_size = piclist[i].code_memory_size;
-			mem.program_memory_size = 0x0F80018;
-			mem.location = (uint16_t*) calloc(mem.program_memory_size,sizeof(uint16_t));
-			mem.filled = (bool*) calloc(mem.program_memory_size,sizeof(bool));
+			mem.init(0x0F80018);
 			found = 1;
 			break;
 		}
@@ -324,6 +324,7 @@ uint8_t pic24fjxxxga1_gb1::blank_check(void)
 		send_nop();
 		send_nop();
 
+		gang_expect_block(mem, addr, true);
 		/* Read six data words (16 bits each) */
 		for (i = 0; i < 6; i++) {
 			send_cmd(0x883C20 + i); // MOV (W0 + i), VISI
@@ -356,7 +357,8 @@ uint8_t pic24fjxxxga1_gb1::blank_check(void)
 			  break;
 			if (flags.debug)
 				fprintf(stderr, "\n addr = 0x%06X data = 0x%04X", (addr + i), data[i]);
-			if ((i%2 == 0 && data[i] != 0xFFFF) || (i%2 == 1 && data[i] != 0x00FF)) {
+			if (gang_targets() == 1 &&
+					((i%2 == 0 && data[i] != 0xFFFF) || (i%2 == 1 && data[i] != 0x00FF))) {
 				if (!flags.debug)
 				  cerr << "\b\b\b\b\b";
 				ret = 1;
@@ -408,7 +410,7 @@ void pic24fjxxxga1_gb1::bulk_erase(void)
 	send_nop();
 	send_nop();
 
-	delay_us(DELAY_P11);
+	delay_ns(DELAY_P11);
 
 	/* Wait while the erase operation completes */
 	do {
@@ -426,11 +428,12 @@ void pic24fjxxxga1_gb1::bulk_erase(void)
 }
 
 /* Read PIC memory and write the contents to a .hex file */
-void pic24fjxxxga1_gb1::read(char *outfile, uint32_t start, uint32_t count)
+bool pic24fjxxxga1_gb1::read(char *outfile, uint32_t start, uint32_t count)
 {
 	uint32_t addr, startaddr, stopaddr;
 	uint16_t data[8], raw_data[6];
 	int i = 0;
+	hex_sink sink(outfile, mem.program_memory_size);
 
 	startaddr = start;
 	stopaddr = mem.code_memory_size;
@@ -520,13 +523,11 @@ void pic24fjxxxga1_gb1::read(char *outfile, uint32_t start, uint32_t count)
 					(addr + i), data[i]);
 
 			if (i % 2 == 0 && data[i] != 0xFFFF) {
-				mem.location[addr + i] = data[i];
-				mem.filled[addr + i] = 1;
+				sink.put(addr + i, data[i]);
 			}
 
 			if (i % 2 == 1 && data[i] != 0x00FF) {
-				mem.location[addr+i] = data[i];
-				mem.filled[addr+i] = 1;
+				sink.put(addr+i, data[i]);
 			}
 		}
 
@@ -566,8 +567,7 @@ void pic24fjxxxga1_gb1::read(char *outfile, uint32_t start, uint32_t count)
 		data[0] = read_data();
 
 		if (data[0] != 0xFFFF) {
-			mem.location[addr + 2 * i] = data[0];
-			mem.filled[addr + 2 * i] = 1;
+			sink.put(addr + 2 * i, data[0]);
 		}
 	}
 
@@ -576,15 +576,13 @@ void pic24fjxxxga1_gb1::read(char *outfile, uint32_t start, uint32_t count)
 
 	if(!flags.debug) cerr << "\b\b\b\b\b";
 	if(flags.client) fprintf(stdout, "@FIN");
-	write_inhx(&mem, outfile);
+	return sink.close();
 }
 
 /* Write contents of the .hex file to the PIC */
 void pic24fjxxxga1_gb1::write(char *infile)
 {
 	uint16_t i,j,p;
-	uint16_t k;
-	bool skip;
 	uint32_t data[8], raw_data[6];
 	uint32_t addr = 0;
 
@@ -613,17 +611,8 @@ void pic24fjxxxga1_gb1::write(char *infile)
 
 	counter = 0;
 
-	for (addr = 0; addr < mem.code_memory_size; ){
-
-		skip = 1;
-
-		for (k = 0; k < 128; k += 2)
-			if (mem.filled[addr + k]) skip = 0;
-
-		if (skip) {
-			addr = addr + 128;
-			continue;
-		}
+	for (addr = mem.next_row(0, 128); addr < mem.code_memory_size;
+			addr = mem.next_row(addr, 128)){
 
 		/* Initialize the Write Pointer (W7) for TBLWT instruction */
 		send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<DestinationAddress23:16>, W0
@@ -632,8 +621,8 @@ void pic24fjxxxga1_gb1::write(char *infile)
 
 		for (p = 0; p < 16; p++) {
 			for (j = 0; j < 8; j++) {
-				if (mem.filled[addr + j])
-					data[j] = mem.location[addr + j];
+				if (mem.filled(addr + j))
+					data[j] = mem.get(addr + j);
 				else
 					data[j] = 0xFFFF;
 				if (flags.debug)
@@ -683,7 +672,7 @@ void pic24fjxxxga1_gb1::write(char *infile)
 		send_nop();
 		send_nop();
 
-		delay_us(DELAY_P13);
+		delay_ns(DELAY_P13);
 
 		/* Wait while the erase operation completes */
 		do {
@@ -744,14 +733,14 @@ void pic24fjxxxga1_gb1::write(char *infile)
 	send_cmd(0x883B0A); // MOV W10, NVMCON
 
 	for (i = 0; i < 3; i++) {
-		if (mem.filled[addr]) {
+		if (mem.filled(addr)) {
 			/* Initialize the Write Pointer (W7) for TBLWT instruction */
 			send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<CWxAddress23:16>, W0
 			send_cmd(0x880190);
 			send_cmd(0x200007 | ((addr & 0x0000FFFF) << 4) ); // MOV #<CWxAddress15:0>, W7
 
 			/* Load the Configuration register data to W6 */
-			send_cmd(0x200006 | ((0x0000FFFF & mem.location[addr]) << 4));
+			send_cmd(0x200006 | ((0x0000FFFF & mem.get(addr)) << 4));
 
 			/*
 			 * Write the Configuration register data to the write
@@ -767,7 +756,7 @@ void pic24fjxxxga1_gb1::write(char *infile)
 			send_nop();
 			send_nop();
 
-			delay_us(DELAY_P20);
+			delay_ns(DELAY_P20);
 
 			/* Wait while the erase operation completes */
 			do {
@@ -782,7 +771,7 @@ void pic24fjxxxga1_gb1::write(char *infile)
 
 			if(flags.debug)
 				fprintf(stderr,"\n - %s set to 0x%01x",
-						regname[i], mem.location[addr]);
+						regname[i], mem.get(addr));
 		} else if(flags.debug) {
 			fprintf(stderr,"\n - %s left unchanged", regname[i]);
 		}
@@ -805,15 +794,8 @@ void pic24fjxxxga1_gb1::write(char *infile)
 		reset_pc();
 		send_nop();
 
-		for (addr = 0; addr < mem.code_memory_size; addr = addr + 8) {
-			skip = 1;
-
-			for(k = 0; k < 8; k += 2)
-				if (mem.filled[addr + k])
-					skip = 0;
-
-			if (skip) continue;
-
+		for (addr = mem.next_row(0, 8); addr < mem.code_memory_size;
+				addr = mem.next_row(addr + 8, 8)) {
 			send_cmd(0x200000 | ((addr & 0x00FF0000) >> 12) ); // MOV #<DestAddress23:16>, W0
 			send_cmd(0x880190); // MOV W0, TBLPAG
 			send_cmd(0x200006 | ((addr & 0x0000FFFF) << 4) ); // MOV #<DestAddress15:0>, W6
@@ -851,6 +833,7 @@ void pic24fjxxxga1_gb1::write(char *infile)
 			send_nop();
 			send_nop();
 
+			gang_expect_block(mem, addr);
 			/* Read six data words (16 bits each) */
 			for (i = 0; i < 6; i++) {
 				send_cmd(0x883C20 + i); // MOV (W0 + i), VISI
@@ -876,9 +859,10 @@ void pic24fjxxxga1_gb1::write(char *infile)
 				if (flags.debug)
 					fprintf(stderr, "\n addr = 0x%06X data = 0x%04X", (addr+i), data[i]);
 
-				if (mem.filled[addr + i] && data[i] != mem.location[addr + i]) {
+				if (mem.filled(addr + i) && data[i] != mem.get(addr + i) &&
+						gang_targets() == 1) {
 					fprintf(stderr,"\n\n ERROR at address %06X: written %04X but %04X read!\n\n",
-						addr + i, mem.location[addr + i], data[i]);
+						addr + i, mem.get(addr + i), data[i]);
 					return;
 				}
 			}
@@ -93,6 +93,9 @@ void pic32::enter_program_mode(void)
 {
 	int i;
 
+	pe_ready = false;
+	fast_2phase = !flags.pe_4phase;
+
 	GPIO_IN(pic_mclr);
 	GPIO_OUT(pic_mclr);
 
@@ -110,9 +113,9 @@ void pic32::enter_program_mode(void)
 			GPIO_SET(pic_data);
 		else
 			GPIO_CLR(pic_data);
-		delay_us(DELAY_P1A);	/* Setup time */
+		delay_bit_us(DELAY_P1A);	/* Setup time */
 		GPIO_SET(pic_clk);
-		delay_us(DELAY_P1B);	/* Hold time */
+		delay_bit_us(DELAY_P1B);	/* Hold time */
 		GPIO_CLR(pic_clk);
 
 	}
@@ -149,9 +152,9 @@ uint8_t pic32::Data4Phase(uint8_t tdi, uint8_t tms){
 		GPIO_CLR(pic_data);	
 	
 	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
+	delay_bit_us(DELAY_P1B);
 	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	delay_bit_us(DELAY_P1A);
 	
 	// write TMS - sampling is on the falling edge
 	if(tms & 0x01)
@@ -160,9 +163,9 @@ uint8_t pic32::Data4Phase(uint8_t tdi, uint8_t tms){
 		GPIO_CLR(pic_data);	
 	
 	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
+	delay_bit_us(DELAY_P1B);
 	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	delay_bit_us(DELAY_P1A);
 	
 	// data pin to input
 	GPIO_CLR(pic_data);
@@ -170,16 +173,16 @@ uint8_t pic32::Data4Phase(uint8_t tdi, uint8_t tms){
 	
 	// "empty" clock pulse
 	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
+	delay_bit_us(DELAY_P1B);
 	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	delay_bit_us(DELAY_P1A);
 	
 	// read TDO, sampling on the rising edge
 	GPIO_SET(pic_clk);
 	tdo = GPIO_LEV(pic_data);
-	delay_us(DELAY_P1B);
+	delay_bit_us(DELAY_P1B);
 	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	delay_bit_us(DELAY_P1A);
 	
 	return (tdo & 0x01);
 }
@@ -195,9 +198,9 @@ void pic32::Data2Phase(uint8_t tdi, uint8_t tms){
 		GPIO_CLR(pic_data);	
 	
 	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
+	delay_bit_us(DELAY_P1B);
 	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	delay_bit_us(DELAY_P1A);
 	
 	// write TMS - sampling is on the falling edge
 	if(tms & 0x01)
@@ -206,9 +209,9 @@ void pic32::Data2Phase(uint8_t tdi, uint8_t tms){
 		GPIO_CLR(pic_data);	
 	
 	GPIO_SET(pic_clk);
-	delay_us(DELAY_P1B);
+	delay_bit_us(DELAY_P1B);
 	GPIO_CLR(pic_clk);
-	delay_us(DELAY_P1A);
+	delay_bit_us(DELAY_P1A);
 }
 
 void pic32::SetMode(uint8_t length, uint8_t mode){
@@ -243,11 +246,13 @@ uint32_t pic32::XferData(uint8_t length, uint32_t iData){
 	// TMS header 100 (TDI set to 0)
     Data4Phase(0, 1);
 	Data4Phase(0, 0);
+	gang_word_begin();
 	oData = Data4Phase(0, 0);
 	
 	// iData, LSb first, with TMS=0
 	for(i=0; i < length-1; i++)
 		oData |= Data4Phase((iData >> i), 0) << (i+1);
+	gang_word_end();
 	
 	// iData MSb with TMS=1
 	Data4Phase((iData >> i), 1);
@@ -259,9 +264,22 @@ uint32_t pic32::XferData(uint8_t length, uint32_t iData){
 	return oData;
 }
 
+/*
+ * 2-phase fast data transfer: half the clocks of XferFastData4P(), but
+ * nothing is read back, so prAcc is not polled. To be used only for the
+ * words of a row following its first one, sent with XferFastData4P(), while
+ * the PE takes them in a loop; the rows are then checked by CRC. Sent with
+ * XferFastData4P() instead with --pe-4phase, or once data sent this way
+ * failed that check (see write()).
+ */
 void pic32::XferFastData2P(uint32_t iData){
 	uint8_t i;
 
+	if(!fast_2phase){
+		XferFastData4P(iData);
+		return;
+	}
+
 	// TMS header 100 (TDI set to 0)
     Data2Phase(0, 1);
 	Data2Phase(0, 0);
@@ -286,12 +304,19 @@ uint32_t pic32::XferFastData4P(uint32_t iData){
 	uint8_t i = 0;
 	uint32_t oData = 0;
 
-	do{
+	while(1){
 		// TMS header 100 (TDI set to 0)
 		Data4Phase(0, 1);
 		Data4Phase(0, 0);
 		i = Data4Phase(0, 0);
-	} while(!i);
+		if(i)
+			break;
+		// prAcc not set, the PE is busy: back to Run-Test/Idle through
+		// Update-DR (ignored by the target) and capture again
+		Data4Phase(0, 1);
+		Data4Phase(0, 1);
+		Data4Phase(0, 0);
+	}
 	
 	// prAcc
 	oData |= Data4Phase(0, 0);
@@ -353,7 +378,9 @@ uint32_t pic32::ReadFromAddress(uint32_t address){
 	return oData;
 }
 
-uint32_t pic32::GetPEResponse(void){
+/* In gang mode, every target's response is checked against expected (in
+ * the bits of mask), if given */
+uint32_t pic32::GetPEResponse(uint32_t addr, uint32_t expected, uint32_t mask){
 	uint32_t response;
 
 	// Wait until CPU is ready
@@ -367,6 +394,8 @@ uint32_t pic32::GetPEResponse(void){
 	// Select Data Register
 	SendCommand(ETAP_DATA);
 	// Receive Response
+	if(mask)
+		gang_expect(addr, expected, mask);
 	response = XferData(32, 0);
 	// Tell CPU to execute instruction
 	SendCommand(ETAP_CONTROL);
@@ -479,7 +508,9 @@ void pic32::download_pe(vector<uint32_t> pe_pointer){
 	XferFastData4P(PE_BASEADDR); 	// Address of PE program block
 	XferFastData4P(pe_size); // Number of 32-bit words of the program block from PE Hex file
 	for(i=0; i<pe_size; i++){
-		XferFastData4P(pe_pointer[i]); // PE software op code from PE Hex file (PE Instructions)
+		// PE software op code from PE Hex file (PE Instructions); all
+		// 4-phase, as nothing reads the PE back to check it
+		XferFastData4P(pe_pointer[i]);
 	}
 
 	// Jump to PE
@@ -490,13 +521,28 @@ void pic32::download_pe(vector<uint32_t> pe_pointer){
 	GetPEResponse();
 }
 
+/*
+ * The PE is downloaded only when an operation needs it (ensure_pe()): the
+ * device ID is read through the MTAP, so checking which device is there
+ * costs a few JTAG transfers instead of a full PE download.
+ */
 bool pic32::setup_pe(void){
 	
+	pe_ready = false;
 	if(!check_device_status()){
         cerr << "Timeout occurred checking device status!" << endl;
         return false;
     }
-        
+	
+	return true;
+}
+
+/* Enter serial execution mode and download the PE, if not done yet */
+bool pic32::ensure_pe(void){
+	
+	if(pe_ready)
+		return true;
+	
     if(!enter_serial_exec_mode()){
     	cerr << "Error entering serial exec mode!" << endl;
         return false;
@@ -518,6 +564,7 @@ bool pic32::setup_pe(void){
 			return false;
 	}
 	
+	pe_ready = true;
 	return true;
 }
 
@@ -526,25 +573,11 @@ bool pic32::read_device_id(void){
 	
 	bool found = false;
 	
-	SendCommand(ETAP_FASTDATA);
-	XferFastData4P(PE_CMD_READ | 0x01);
-	
-	switch(subfamily){
-		case SF_PIC32MX1:
-		case SF_PIC32MX2:
-		case SF_PIC32MX3:
-			XferFastData4P(0x1F80F220);
-			break;
-		case SF_PIC32MZ:
-		case SF_PIC32MK:
-			XferFastData4P(0x1F800020);
-			break;
-		default:
-			XferFastData4P(0x1F80F220);
-			break;
-	}
-	GetPEResponse();
-	rxp = GetPEResponse();
+	/* the IDCODE has the same layout as the DEVID register */
+	SendCommand(MTAP_SW_MTAP);
+	SendCommand(MTAP_IDCODE);
+	rxp = XferData(32, 0);
+	SendCommand(MTAP_SW_ETAP);
 	device_id = (rxp & 0x0FFFFFFF);
 	device_rev = (uint16_t)(rxp >> 28);
 	
@@ -553,9 +586,7 @@ bool pic32::read_device_id(void){
 		if (piclist[i].device_id == device_id){
 			strcpy(name, piclist[i].name);
 			mem.code_memory_size = piclist[i].code_memory_size;
-			mem.program_memory_size = 0x03000000;
-			mem.location = (uint16_t*) calloc(mem.program_memory_size,sizeof(uint16_t));
-			mem.filled = (bool*) calloc(mem.program_memory_size,sizeof(bool));
+			mem.init(0x03000000);
 			found = true;
 			break;
 		}
@@ -565,22 +596,27 @@ bool pic32::read_device_id(void){
 		case SF_PIC32MX1:
 		case SF_PIC32MX2:
 			rowsize  = 128;
+			pagesize = 0x00000400;
 			bootsize = 0x00000C00;
 			break;
 		case SF_PIC32MX3:
 			rowsize  = 512;
+			pagesize = 0x00001000;
 			bootsize = 0x00003000;
 			break;
 		case SF_PIC32MK:
 			rowsize  = 2048;
+			pagesize = 0x00001000;
 			bootsize = 0x00005000;
 			break;
 		case SF_PIC32MZ:
 			rowsize  = 2048;
+			pagesize = 0x00004000;
 			bootsize = 0x00014000;
 			break;
 		default:
 			rowsize  = 128;
+			pagesize = 0x00000400;
 			bootsize = 0x00000C00;
 			break;
 	}
@@ -592,6 +628,7 @@ void pic32::bulk_erase(void){
 	
 	uint32_t rxp;
 	
+	if(!ensure_pe()) return;
 	SendCommand(ETAP_FASTDATA);
 	XferFastData4P(PE_CMD_CHIP_ERASE);
 	rxp = GetPEResponse();
@@ -603,18 +640,20 @@ void pic32::bulk_erase(void){
 
 uint8_t pic32::blank_check(void){
 	uint32_t rxp = 0;
+	if(!ensure_pe()) return 1;
 	SendCommand(ETAP_FASTDATA);
 	XferFastData4P(PE_CMD_BLANK_CHECK);
 	XferFastData4P(PROGRAM_FLASH_BASEADDR);
 	XferFastData4P(mem.code_memory_size*2);
-	rxp = GetPEResponse();
-	if(rxp==PE_CMD_BLANK_CHECK)
+	rxp = GetPEResponse(PROGRAM_FLASH_BASEADDR, PE_CMD_BLANK_CHECK,
+			0xFFFFFFFF);
+	if(rxp==PE_CMD_BLANK_CHECK || gang_targets() > 1)
 		return 0;
 	else
 		return 1;
 };
 
-void pic32::read(char *outfile, uint32_t start, uint32_t count){
+bool pic32::read(char *outfile, uint32_t start, uint32_t count){
 	uint32_t rxp = 0;
 	uint32_t blocksize = 0;	// expressed in bytes
 	const uint32_t max_blocksize = 0x0000FFFF*4;
@@ -622,6 +661,9 @@ void pic32::read(char *outfile, uint32_t start, uint32_t count){
 	uint32_t counter = 0, read_locations = 0, i = 0;
 	uint8_t area = PROGRAM_AREA;
 	uint32_t addr=0, startaddr = 0, stopaddr = 0;
+	
+	if(!ensure_pe()) return false;
+	hex_sink sink(outfile, mem.program_memory_size, PROGRAM_FLASH_BASEADDR);
 		
 	if(!flags.debug) cerr << "[ 0%]";
 	if(flags.client) fprintf(stdout, "@000");
@@ -670,10 +712,8 @@ void pic32::read(char *outfile, uint32_t start, uint32_t count){
 					int word_addr = (addr + i) / 2;
 					rxp = GetPEResponse();
 					if(flags.fulldump || (rxp != 0xFFFFFFFF)) {
-						mem.location[word_addr] = rxp & 0x0000FFFF;
-						mem.filled[word_addr] = 1;
-						mem.location[word_addr+1] = rxp >> 16;
-						mem.filled[word_addr+1] = 1;
+						sink.put(word_addr, rxp & 0xFFFF);
+						sink.put(word_addr + 1, rxp >> 16);
 					}
 					
 					read_locations += 4;
@@ -694,130 +734,292 @@ void pic32::read(char *outfile, uint32_t start, uint32_t count){
 
 	if(!flags.debug) cerr << "\b\b\b\b\b";
 	if(flags.client) fprintf(stdout, "@FIN");
-	write_inhx(&mem, outfile, PROGRAM_FLASH_BASEADDR);
+	return sink.close();
 };
 
+/* 32-bit word of the image at (16-bit) word address addr, low half first;
+ * halves not filled read as erased flash (0xFFFF) */
+static inline uint32_t image_word(const memory &mem, uint32_t addr)
+{
+	uint32_t lo = mem.filled(addr) ? mem.get(addr) : 0xFFFF;
+	uint32_t hi = mem.filled(addr+1) ? mem.get(addr+1) : 0xFFFF;
+
+	return lo | (hi << 16);
+}
+
+/* CRC-CCITT (polynomial 0x1021, MSb first), as computed by PE_CMD_GET_CRC */
+static uint16_t crc_table[256];
+static bool crc_table_ready = false;
+
+static void crc_table_init(void)
+{
+	uint16_t crc;
+
+	for(int b=0; b<256; b++){
+		crc = b << 8;
+		for(int i=0; i<8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		crc_table[b] = crc;
+	}
+	crc_table_ready = true;
+}
+
+static inline uint16_t crc_byte(uint16_t crc, uint8_t byte)
+{
+	return (crc << 8) ^ crc_table[(crc >> 8) ^ byte];
+}
+
+/* CRC of length bytes of the image from addr (in bytes); words not
+ * filled are erased, 0xFF bytes */
+uint16_t pic32::image_crc(uint32_t addr, uint32_t length){
+	uint16_t crc = 0xFFFF;
+	uint32_t word;
+
+	if(!crc_table_ready)
+		crc_table_init();
+
+	for(uint32_t i=0; i<length; i+=4){
+		word = image_word(mem, (addr+i)/2);
+		crc = crc_byte(crc, word & 0xFF);
+		crc = crc_byte(crc, (word >> 8) & 0xFF);
+		crc = crc_byte(crc, (word >> 16) & 0xFF);
+		crc = crc_byte(crc, word >> 24);
+	}
+	return crc;
+}
+
+/* CRC of length bytes of the device flash from addr, computed by the PE;
+ * in gang mode, every target's is checked against expected, if given */
+uint16_t pic32::device_crc(uint32_t addr, uint32_t length, int expected){
+	uint32_t rxp;
+
+	SendCommand(ETAP_FASTDATA);
+	XferFastData4P(PE_CMD_GET_CRC);
+	XferFastData4P(PROGRAM_FLASH_BASEADDR+addr);
+	XferFastData4P(length);
+	rxp = GetPEResponse();
+	if(rxp != PE_CMD_GET_CRC)
+		fprintf(stderr, "___ERR___: %08x\n", rxp);
+	if(expected < 0)
+		return GetPEResponse() & 0xFFFF;
+	return GetPEResponse(PROGRAM_FLASH_BASEADDR+addr, expected, 0xFFFF) &
+			0xFFFF;
+}
+
+void pic32::page_erase(uint32_t addr){
+	uint32_t rxp;
+
+	SendCommand(ETAP_FASTDATA);
+	XferFastData4P(PE_CMD_PAGE_ERASE | 0x01);
+	XferFastData4P(PROGRAM_FLASH_BASEADDR+addr);
+	rxp = GetPEResponse();
+	if(rxp != PE_CMD_PAGE_ERASE)
+		fprintf(stderr, "___ERR___: %08x\n", rxp);
+}
+
+/* Bounds (in bytes) of an area, false if excluded by --boot-only or
+ * --program-only */
+bool pic32::area_selected(uint8_t area, uint32_t &startaddr,
+		uint32_t &stopaddr){
+	if(area == PROGRAM_AREA){
+		startaddr = 0;
+		stopaddr = mem.code_memory_size*2;
+		return !flags.boot_only;
+	}
+	startaddr = BOOTFLASH_OFFSET;
+	stopaddr = startaddr+bootsize;
+	return !flags.program_only;
+}
+
+/*
+ * Program the rows of [startaddr, stopaddr) (in bytes) holding data; the
+ * others are left erased. Runs of consecutive rows are sent as a single
+ * PROGRAM command, with one response at the end; isolated rows with
+ * ROW_PROGRAM. A failing response is reported with the rows it covers.
+ * programmed counts the words sent, out of total, for the progress
+ * indicator (none if total is 0).
+ */
+void pic32::program_rows(uint32_t startaddr, uint32_t stopaddr,
+		uint32_t &programmed, uint32_t total){
+	uint32_t rxp, addr, next, word, command;
+	uint32_t counter = total ? programmed*100/total : 0;
+
+	for (addr = 2*mem.next_row(startaddr/2, rowsize/2); addr < stopaddr;
+			addr = 2*mem.next_row(next/2, rowsize/2)){
+		
+		next = addr+rowsize;
+		while(next < stopaddr && mem.next_row(next/2, rowsize/2) == next/2)
+			next += rowsize;
+		
+		SendCommand(ETAP_FASTDATA);
+		if(next - addr == rowsize){
+			command = PE_CMD_ROW_PROGRAM;
+			XferFastData4P(PE_CMD_ROW_PROGRAM);
+			XferFastData4P(PROGRAM_FLASH_BASEADDR+addr);
+		}
+		else{
+			command = PE_CMD_PROGRAM;
+			XferFastData4P(PE_CMD_PROGRAM);
+			XferFastData4P(PROGRAM_FLASH_BASEADDR+addr);
+			XferFastData4P(next-addr);
+		}
+		
+		for(uint32_t i=0; i<next-addr; i+=4){
+			word = image_word(mem, (addr+i)/2);
+			programmed += mem.filled((addr+i)/2) + mem.filled((addr+i)/2+1);
+			/* the PE is ready for the rest of a row once it has
+			 * taken its first word */
+			if(i % rowsize == 0)
+				XferFastData4P(word);
+			else
+				XferFastData2P(word);
+		}
+		rxp = GetPEResponse();
+		if(rxp != command && next - addr == rowsize)
+			fprintf(stderr, "___ERR___: %08x programming row %08x\n", rxp,
+					PROGRAM_FLASH_BASEADDR+addr);
+		else if(rxp != command)
+			fprintf(stderr, "___ERR___: %08x programming rows %08x-%08x\n",
+					rxp, PROGRAM_FLASH_BASEADDR+addr,
+					PROGRAM_FLASH_BASEADDR+next-rowsize);
+			
+		if(total && counter != programmed*100/total){
+			counter = programmed*100/total;
+			if(flags.client)
+				fprintf(stdout,"@%03d", counter);
+			if(!flags.debug)
+				fprintf(stderr,"\b\b\b\b\b[%2d%%]", counter);
+		}
+	}
+}
+
+/*
+ * Compare the CRC of [startaddr, stopaddr) on the device and in the image,
+ * in regions of flags.verify_region bytes (whole pages, see write()); the
+ * pages of a region that does not match are checked one by one, and the
+ * failing ones are added to bad. With gang_check, every gang target's
+ * region CRCs are checked against the image.
+ */
+void pic32::verify_crc(uint32_t startaddr, uint32_t stopaddr,
+		vector<uint32_t> &bad, bool gang_check){
+	uint32_t region, addr, end, page, length;
+	uint16_t crc;
+
+	region = flags.verify_region;
+	for(addr = startaddr; addr < stopaddr; addr = end){
+		end = std::min(addr + region, stopaddr);
+		crc = image_crc(addr, end-addr);
+		if(device_crc(addr, end-addr, gang_check ? crc : -1) == crc)
+			continue;
+		for(page = addr; page < end; page += pagesize){
+			length = std::min(pagesize, end-page);
+			if(region == pagesize ||
+					device_crc(page, length) != image_crc(page, length))
+				bad.push_back(page);
+		}
+	}
+}
+
 void pic32::write(char *infile){
-	uint32_t rxp = 0;
 	uint8_t area = PROGRAM_AREA;
-	uint32_t addr = 0, startaddr = 0, stopaddr = 0;
+	uint32_t startaddr = 0, stopaddr = 0;
 	uint32_t filled_locations = 0, programmed_locations = 0;
-	bool skip = true;
-	uint32_t counter = 0;
-	uint32_t device_checksum = 0, calculated_checksum = 0;
+	uint32_t page, pagestop;
+	vector<uint32_t> changed, bad;
+	
+	if(flags.verify_region % pagesize){
+		fprintf(stderr, "Error: --verify-region must be a multiple of the "
+				"erase page of this device (%u bytes)\n", pagesize);
+		if(flags.client) fprintf(stdout, "@ERR");
+		return;
+	}
 	
 	filled_locations = read_inhx(infile, &mem, PROGRAM_FLASH_BASEADDR);
 	if(!filled_locations) return;
-	
-	bulk_erase();
+	if(!ensure_pe()) return;
+	
+	/* INCREMENTAL: only the pages whose CRC on the device differs from
+	 * the image are erased and programmed, instead of the whole chip */
+	if(flags.incremental){
+		for(area = PROGRAM_AREA; area <= BOOT_AREA; area++){
+			if(!area_selected(area, startaddr, stopaddr))
+				continue;
+			verify_crc(startaddr, stopaddr, changed);
+		}
+		filled_locations = 0;
+		for(size_t i=0; i<changed.size(); i++)
+			filled_locations += mem.count_filled(changed[i]/2, pagesize/2);
+		fprintf(stderr, "Incremental write: %zu pages changed\n",
+				changed.size());
+	}
+	else
+		bulk_erase();
 	
 	if(!flags.debug) cerr << "[ 0%]";
 	if(flags.client) fprintf(stdout, "@000");
 	
-	do{
-
-		switch(area){
-			case PROGRAM_AREA:	// Write Program Flash
-				startaddr = 0;
-				stopaddr = (mem.code_memory_size*2)-1;
-				break;
-			case BOOT_AREA:	// Write bootflash+configuration
-				startaddr = BOOTFLASH_OFFSET;
-				stopaddr = startaddr+bootsize-1;
-				break;
-			default:
-				break;
+	if(flags.incremental){
+		for(size_t i=0; i<changed.size(); i++){
+			page_erase(changed[i]);
+			program_rows(changed[i], changed[i]+pagesize,
+					programmed_locations, filled_locations);
 		}
-		
-		if(((area == PROGRAM_AREA) & !flags.boot_only) || ((area == BOOT_AREA) & !flags.program_only)){
-	
-			for (addr = startaddr; addr < stopaddr; addr += rowsize){
-				
-				skip = true;
-				for(uint32_t i=0; i<rowsize; i++){
-					if(mem.filled[(addr+i)/2]){
-						skip = false;
-						break;
-					}
-				}
-				if(skip){
-					calculated_checksum += 0x000000FF*rowsize;
-					continue;
-				}
-				
-				SendCommand(ETAP_FASTDATA);
-				XferFastData4P(PE_CMD_ROW_PROGRAM);
-				XferFastData4P(PROGRAM_FLASH_BASEADDR+addr);
-				
-				for(uint32_t i=0; i<rowsize; i+=4){
-					if(mem.filled[(addr+i)/2]){
-						XferFastData4P((uint32_t)mem.location[(addr+i)/2] |
-									((uint32_t)mem.location[(addr+i)/2+1] << 16));
-						programmed_locations += 2;
-						if((addr+i) < (BOOTFLASH_OFFSET+bootsize-16)){
-							calculated_checksum += (mem.location[(addr+i)/2] & 0x00FF) +
-												(mem.location[(addr+i)/2] >> 8) +
-												(mem.location[(addr+i)/2+1] & 0x00FF) +
-												(mem.location[(addr+i)/2+1] >> 8);
-						}
-					}
-					else{
-						XferFastData4P(0xFFFFFFFF);
-						if((addr+i) < (BOOTFLASH_OFFSET+bootsize-16))
-							calculated_checksum += 0x000000FF*4;
-					}
-				}
-				rxp = GetPEResponse();
-				if(rxp != PE_CMD_ROW_PROGRAM)
-					fprintf(stderr, "___ERR___: %08x\n", rxp);
-					
-				if(counter != programmed_locations*100/filled_locations){
-					counter = programmed_locations*100/filled_locations;
-					if(flags.client)
-						fprintf(stdout,"@%03d", counter);
-					if(!flags.debug)
-						fprintf(stderr,"\b\b\b\b\b[%2d%%]", counter);
-				}
-			}
+	}
+	else{
+		for(area = PROGRAM_AREA; area <= BOOT_AREA; area++){
+			if(!area_selected(area, startaddr, stopaddr))
+				continue;
+			program_rows(startaddr, stopaddr, programmed_locations,
+					filled_locations);
 		}
-		area++;
-	} while(area<=BOOT_AREA);
+	}
 	
 	if(!flags.debug) cerr << "\b\b\b\b\b\b";
-	if(flags.client) fprintf(stdout, "@FIN");
-	
-	// Checksum verification
-	// Program area checksum
-	SendCommand(ETAP_FASTDATA);
-	XferFastData4P(PE_CMD_GET_CHECKSUM);
-	XferFastData4P(PROGRAM_FLASH_BASEADDR);
-	XferFastData4P(mem.code_memory_size*2);
-	rxp = GetPEResponse();
-	if(rxp != PE_CMD_GET_CHECKSUM)
-		fprintf(stderr, "___ERR___: %08x\n", rxp);
-	device_checksum = GetPEResponse();
-	
-	// Boot area checksum
-	SendCommand(ETAP_FASTDATA);
-	XferFastData4P(PE_CMD_GET_CHECKSUM);
-	XferFastData4P(PROGRAM_FLASH_BASEADDR+BOOTFLASH_OFFSET);
-	XferFastData4P(bootsize-16);
-	rxp = GetPEResponse();
-	if(rxp != PE_CMD_GET_CHECKSUM)
-		fprintf(stderr, "___ERR___: %08x\n", rxp);
-	device_checksum += GetPEResponse();
-	
-	if(calculated_checksum != device_checksum){
-		fprintf(stderr, "___CHECKSUM ERROR!___\n");
-		fprintf(stderr, "DEVICE CHECKSUM: %08x\n", device_checksum);
-		fprintf(stderr, "CALCULATED CHECKSUM: %08x\n", calculated_checksum);
-		if(flags.client) fprintf(stdout, "@ERR");
-		return;
+
+	/* VERIFY: by CRC, the configuration words at the end of the boot
+	 * flash excluded; failing pages are erased and programmed again, once
+	 * (not in gang mode, where each target's result is left to
+	 * gang_report()) */
+	if(!flags.noverify){
+		for(area = PROGRAM_AREA; area <= BOOT_AREA; area++){
+			if(!area_selected(area, startaddr, stopaddr))
+				continue;
+			if(area == BOOT_AREA)
+				stopaddr -= 16;
+			verify_crc(startaddr, stopaddr, bad, true);
+		}
+		if(gang_targets() > 1)
+			bad.clear();
+
+		if(!bad.empty() && fast_2phase){
+			fprintf(stderr, "CRC mismatch after 2-phase fast data, using "
+					"4-phase from now on (see --pe-4phase)\n");
+			fast_2phase = false;
+		}
+		for(size_t i=0; i<bad.size(); i++){
+			page = bad[i];
+			pagestop = page + pagesize;
+			fprintf(stderr, "CRC mismatch in page %08x, programming it again\n",
+					PROGRAM_FLASH_BASEADDR+page);
+			page_erase(page);
+			program_rows(page, pagestop, programmed_locations, 0);
+			if(page >= BOOTFLASH_OFFSET &&
+					pagestop > BOOTFLASH_OFFSET+bootsize-16)
+				pagestop = BOOTFLASH_OFFSET+bootsize-16;
+			if(device_crc(page, pagestop-page) != image_crc(page, pagestop-page)){
+				fprintf(stderr, "___CRC ERROR!___ in page %08x\n",
+						PROGRAM_FLASH_BASEADDR+page);
+				if(flags.client) fprintf(stdout, "@ERR");
+				return;
+			}
+		}
 	}
 	
 	if(flags.client) fprintf(stdout, "@FIN");
 };
+
 void pic32::dump_configuration_registers(void){
+	if(!ensure_pe()) return;
 	SendCommand(ETAP_FASTDATA);
 	XferFastData4P(PE_CMD_READ | 0x04);
 	XferFastData4P(PROGRAM_FLASH_BASEADDR+BOOTFLASH_OFFSET+bootsize-16);
@@ -42,6 +42,8 @@ class pic32: public Pic{
 	public:
 		pic32(uint8_t sf){
 			subfamily=sf;
+			pe_ready=false;
+			fast_2phase=true;
 		};
 		void enter_program_mode(void);
 		void exit_program_mode(void);
@@ -49,7 +51,7 @@ class pic32: public Pic{
 		bool read_device_id(void);
 		void bulk_erase(void);
 		void dump_configuration_registers(void);
-		void read(char *outfile, uint32_t start=0, uint32_t count=0);
+		bool read(char *outfile, uint32_t start=0, uint32_t count=0);
 		void write(char *infile);
 		uint8_t blank_check(void);
 		void write_user_id(uint64_t){};
@@ -65,14 +67,29 @@ class pic32: public Pic{
 		uint32_t XferFastData4P(uint32_t iData);
 		void XferInstruction(uint32_t instruction);
 		uint32_t ReadFromAddress(uint32_t address);
-		uint32_t GetPEResponse(void);
+		uint32_t GetPEResponse(uint32_t addr = 0, uint32_t expected = 0,
+				uint32_t mask = 0);
 		bool check_device_status(void);
 		void code_protected_bulk_erase(void);
 		bool enter_serial_exec_mode(void);
 		void download_pe(vector<uint32_t> pe_pointer);
+		bool ensure_pe(void);
+		bool area_selected(uint8_t area, uint32_t &startaddr,
+				uint32_t &stopaddr);
+		void program_rows(uint32_t startaddr, uint32_t stopaddr,
+				uint32_t &programmed, uint32_t total);
+		void page_erase(uint32_t addr);
+		uint16_t image_crc(uint32_t addr, uint32_t length);
+		uint16_t device_crc(uint32_t addr, uint32_t length,
+				int expected = -1);
+		void verify_crc(uint32_t startaddr, uint32_t stopaddr,
+				vector<uint32_t> &bad, bool gang_check = false);
 		
 		uint32_t bootsize;
 		uint32_t rowsize;
+		uint32_t pagesize;		// erase page, in bytes
+		bool pe_ready;			// PE downloaded and running
+		bool fast_2phase;		// XferFastData2P() sends 2-phase words
 
 		/*
 		* DEVICES SECTION
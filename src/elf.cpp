@@ -0,0 +1,179 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <elf.h>
+
+#include <iostream>
+
+#include "common.h"
+
+using namespace std;
+
+#ifndef EM_DSPIC30F
+#define EM_DSPIC30F		118
+#endif
+
+/*
+ * ELF firmware images, as linked by XC32 and XC16, are loaded straight
+ * from the mapped file: the file contents of each PT_LOAD segment are
+ * copied into the image at the segment physical (load) address, so
+ * initialized data is taken from its flash copy and RAM-only segments
+ * fall outside the image.
+ *
+ * Load addresses are turned into the byte addresses of the hex files:
+ *  - PIC32 (EM_MIPS): KSEG0/KSEG1 addresses are mapped to physical ones;
+ *  - PIC24/dsPIC (EM_DSPIC30F): program addresses count one unit per
+ *    16-bit word, so they are doubled. Only program space segments are
+ *    loaded: the data space (RAM, SFRs) has addresses of its own, which
+ *    would alias flash once doubled;
+ *  - anything else is taken as a byte address.
+ * The offset passed by the driver is then subtracted as for hex files.
+ */
+
+bool is_elf(const void *buf, size_t size)
+{
+	return size >= SELFMAG && memcmp(buf, ELFMAG, SELFMAG) == 0;
+}
+
+/* Byte address of a segment loaded at paddr */
+static uint32_t load_address(uint16_t machine, uint32_t paddr)
+{
+	switch (machine) {
+		case EM_MIPS:
+			return paddr & 0x1FFFFFFF;
+		case EM_DSPIC30F:
+			return paddr * 2;
+		default:
+			return paddr;
+	}
+}
+
+/*
+ * Whether a segment belongs in the program image. A dsPIC data space
+ * segment is writable and has no separate load address (XC16 initializes
+ * RAM from .dinit templates in program space, not from a load image).
+ */
+static bool program_segment(uint16_t machine, const Elf32_Phdr &phdr)
+{
+	if (machine != EM_DSPIC30F)
+		return true;
+	if ((phdr.p_flags & PF_W) && phdr.p_paddr == phdr.p_vaddr)
+		return false;
+	return phdr.p_paddr < 0x01000000;	// 24-bit program counter
+}
+
+/* Store an odd leading/trailing byte, keeping the other half if filled */
+static unsigned int store_byte(memory *mem, uint32_t addr, bool high,
+		uint8_t byte)
+{
+	uint16_t data;
+
+	if (addr >= mem->program_memory_size)
+		return 0;
+	data = mem->filled(addr) ? mem->get(addr) : 0xFFFF;
+	data = high ? (data & 0x00FF) | (byte << 8) : (data & 0xFF00) | byte;
+	mem->put(addr, data);
+	return 1;
+}
+
+/*
+ * Load the segments of the ELF file in buf into the memory structure.
+ * Returns the number of filled locations
+ */
+unsigned int read_elf(const void *buf, size_t size, memory *mem,
+		uint32_t offset)
+{
+	const uint8_t *file = (const uint8_t *) buf;
+	const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *) buf;
+	const Elf32_Phdr *phdr;
+	uint32_t byte_addr, addr, len, words, stored;
+	const uint8_t *data;
+	unsigned int filled_locations = 0;
+
+	if (size < sizeof(Elf32_Ehdr) || ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+			ehdr->e_ident[EI_DATA] != ELFDATA2LSB) {
+		cerr << "Error: only 32-bit little-endian ELF files are supported."
+			 << endl;
+		return 0;
+	}
+	if (ehdr->e_phnum == 0 || ehdr->e_phentsize != sizeof(Elf32_Phdr) ||
+			ehdr->e_phoff > size ||
+			(size - ehdr->e_phoff) / sizeof(Elf32_Phdr) < ehdr->e_phnum) {
+		cerr << "Error: ELF file has no valid program headers." << endl;
+		return 0;
+	}
+
+	if (flags.debug)
+		fprintf(stderr, "  ELF machine %u, %u program headers\n",
+				ehdr->e_machine, ehdr->e_phnum);
+
+	phdr = (const Elf32_Phdr *) (file + ehdr->e_phoff);
+	for (unsigned int i = 0; i < ehdr->e_phnum; i++) {
+		if (phdr[i].p_type != PT_LOAD || phdr[i].p_filesz == 0)
+			continue;
+		if (phdr[i].p_offset > size || size - phdr[i].p_offset < phdr[i].p_filesz) {
+			cerr << "Error: ELF segment beyond end of file." << endl;
+			return 0;
+		}
+		if (!program_segment(ehdr->e_machine, phdr[i])) {
+			if (flags.debug)
+				fprintf(stderr, "  segment %u: data space (paddr 0x%08X), "
+						"skipped\n", i, phdr[i].p_paddr);
+			continue;
+		}
+
+		byte_addr = load_address(ehdr->e_machine, phdr[i].p_paddr);
+		data = file + phdr[i].p_offset;
+		len = phdr[i].p_filesz;
+
+		if (flags.debug)
+			fprintf(stderr, "  segment %u: %u bytes @0x%08X (paddr 0x%08X)\n",
+					i, len, byte_addr, phdr[i].p_paddr);
+
+		addr = byte_addr/2 - offset/2;
+		if (addr >= mem->program_memory_size) {
+			fprintf(stderr, " ELF file contains out of range segment (addr=0x%08X); ignored!\n", byte_addr);
+			continue;
+		}
+
+		/* a segment starting on an odd byte fills the high half first */
+		if (byte_addr % 2) {
+			filled_locations += store_byte(mem, addr++, true, *data++);
+			len--;
+		}
+		words = len / 2;
+		stored = mem->put_block(addr, data, words);
+		filled_locations += stored;
+		if (stored < words)
+			fprintf(stderr, " ELF file contains out of range memory data (addr=0x%08X); ignored!\n", (addr + stored)*2 + offset);
+		else if (len % 2)
+			filled_locations += store_byte(mem, addr + words, false,
+					data[2*words]);
+	}
+
+	if(flags.debug)
+		cerr << "DONE! " << filled_locations << " memory locations read." << endl;
+
+	return filled_locations;
+}
@@ -0,0 +1,234 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <deque>
+
+#include "common.h"
+
+/*
+ * Gang programming: several identical targets share PGC and MCLR, each
+ * one with its own PGD line, and are driven in lockstep by the normal
+ * driver code. Target 1 (the first PGD) is the one the driver talks to.
+ * Every level read samples all the PGD lines at once; the read primitives
+ * bracket the data bits of a word with gang_word_begin()/gang_word_end(),
+ * so each target's word is assembled from its own line. The blank check
+ * and verify loops queue, before each read, the value they expect with
+ * gang_expect(): every target, target 1 included, is compared against it.
+ * Reads with nothing queued (status polling, handshakes, plain reads) are
+ * not checked, as the targets may legitimately differ there.
+ */
+#define GANG_MAX	16
+
+static int targets = 1;
+static int nums[GANG_MAX];			// PGD gpio of each target
+static int shifts[GANG_MAX];		// its bit in the level register
+static gpio_pin lines[GANG_MAX];	// PGD lines of targets 2..n
+
+static bool capturing;				// between gang_word_begin() and _end()
+static int bits;					// data bits sampled in the current word
+static uint32_t words[GANG_MAX];	// the current word, per target
+
+struct gang_expectation {
+	uint32_t addr;
+	uint32_t value;
+	uint32_t mask;					// bits to compare, 0 for none
+};
+static std::deque<gang_expectation> expected;
+
+static unsigned long checked;		// words compared, for every target
+static unsigned long failed[GANG_MAX];
+static uint32_t first_failed[GANG_MAX];
+
+/* Parse a PGD1+PGD2+... list into pin data (target 1) and the others */
+bool gang_parse(const char *list, gpio_pin &data)
+{
+#ifdef GPIO_GANG
+	const char *p = list;
+	char *end;
+
+	targets = 0;
+	while (*p) {
+		if (targets == GANG_MAX) {
+			fprintf(stderr, "Gang mode: at most %d targets\n", GANG_MAX);
+			return false;
+		}
+		nums[targets++] = strtol(p, &end, 10);
+		if (end == p || (*end != '+' && *end != '\0'))
+			return false;
+		p = (*end == '+') ? end + 1 : end;
+	}
+	if (targets == 0)
+		return false;
+
+	data.num = nums[0];
+	return true;
+#else
+	fprintf(stderr, "Gang mode is not supported on this host\n");
+	return false;
+#endif
+}
+
+int gang_targets(void)
+{
+	return targets;
+}
+
+/* Chain the other targets' PGD lines to the resolved PGD pin */
+void gang_resolve(gpio_pin &data)
+{
+	gpio_pin *prev = &data;
+
+	if (targets < 2)
+		return;
+
+	shifts[0] = data.shift;
+	for (int i = 1; i < targets; i++) {
+		lines[i] = gpio_pin(nums[i]);
+		gpio_backend::resolve(lines[i]);
+		shifts[i] = lines[i].shift;
+		data.mask |= lines[i].mask;
+		prev->gang = &lines[i];
+		prev = &lines[i];
+	}
+}
+
+void gang_sample(uint32_t levels)
+{
+	if (!capturing)
+		return;
+
+	for (int i = 0; i < targets; i++)
+		words[i] |= ((levels >> shifts[i]) & 0x1) << bits;
+	bits++;
+}
+
+/* The next level reads are the data bits of a word, LSB first */
+void gang_word_begin(void)
+{
+	if (targets < 2)
+		return;
+
+	capturing = true;
+	bits = 0;
+	memset(words, 0, sizeof(words));
+}
+
+/* Compare each target's word with the expectation queued for it, if any */
+void gang_word_end(void)
+{
+	gang_expectation e;
+
+	if (!capturing)
+		return;
+	capturing = false;
+
+	if (expected.empty())
+		return;
+	e = expected.front();
+	expected.pop_front();
+	if (e.mask == 0)
+		return;
+
+	checked++;
+	for (int i = 0; i < targets; i++)
+		if ((words[i] ^ e.value) & e.mask)
+			if (failed[i]++ == 0)
+				first_failed[i] = e.addr;
+}
+
+/* The next word read should be value (in the bits of mask) at addr */
+void gang_expect(uint32_t addr, uint32_t value, uint32_t mask)
+{
+	if (targets < 2)
+		return;
+
+	expected.push_back({addr, value, mask});
+}
+
+/*
+ * Queue the six words W0:W5 of a dsPIC/PIC24 block read of the four
+ * instructions at addr (the drivers' "store data correctly" packing, two
+ * 16-bit lower words and the two upper bytes in every three words): the
+ * image words where filled, or erased ones when blank.
+ */
+void gang_expect_block(memory &mem, uint32_t addr, bool blank)
+{
+	static const int slot[8] = {0, 1, 2, 1, 3, 4, 5, 4};
+	static const int shift[8] = {0, 0, 0, 8, 0, 0, 0, 8};
+	uint32_t value[6] = {0}, mask[6] = {0}, m;
+
+	if (targets < 2)
+		return;
+
+	for (int i = 0; i < 8; i++) {
+		m = (i % 2) ? 0x00FF : 0xFFFF;
+		if (blank)
+			value[slot[i]] |= m << shift[i];
+		else if (mem.filled(addr+i))
+			value[slot[i]] |= (mem.get(addr+i) & m) << shift[i];
+		else
+			continue;
+		mask[slot[i]] |= m << shift[i];
+	}
+	for (int i = 0; i < 6; i++)
+		gang_expect(addr, value[i], mask[i]);
+}
+
+/* Start a new operation */
+void gang_reset(void)
+{
+	capturing = false;
+	expected.clear();
+	checked = 0;
+	memset(failed, 0, sizeof(failed));
+}
+
+/* Words of target t (from 0) that did not match in the last operation, out
+ * of words checked, the first one at address first */
+unsigned long gang_failures(int t, unsigned long &words, uint32_t &first)
+{
+	words = checked;
+	first = first_failed[t];
+	return failed[t];
+}
+
+/* Print the status of every target for the last operation */
+void gang_report(void)
+{
+	if (checked == 0) {
+		fprintf(stdout, "Gang: nothing verified, the data read is target "
+				"1's\n");
+		return;
+	}
+	for (int i = 0; i < targets; i++) {
+		if (failed[i] == 0)
+			fprintf(stdout, "Gang target %d (PGD %d): OK, %lu words as "
+					"expected\n", i+1, nums[i], checked);
+		else
+			fprintf(stdout, "Gang target %d (PGD %d): FAILED, %lu of %lu "
+					"words differ, the first at address %06X\n", i+1,
+					nums[i], failed[i], checked, first_failed[i]);
+	}
+}
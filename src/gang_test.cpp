@@ -0,0 +1,343 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "common.h"
+#include "devices/pic18fj.h"
+
+/*
+ * Tests of gang mode (gang.cpp) with the PIC18FxxJxx driver, against three
+ * simulated targets (built with gpio_sim.h) sharing PGC and MCLR, each on
+ * its own PGD line: target 1 has a flash cell that does not program, target
+ * 2 is good and target 3 ignores erase and programming. Each target must be
+ * reported on its own, against what the driver wrote, whatever target 1
+ * returns. Run with `make test`.
+ */
+
+struct flags_struct flags;
+
+gpio_pin pic_clk(20), pic_data, pic_mclr(21);
+
+/* PGD lines of the targets, also their bits in the level word */
+static const int pgd[] = {4, 9, 17};
+#define TARGETS		3
+
+#define DEVICE_ID	0x4C00		// PIC18F24J50, 0x2000 words
+#define IMAGE_WORDS	40			// over two 32-word rows
+#define STUCK_ADDR	0x47		// byte of target 1 that does not program...
+#define STUCK_BITS	0x80		// ...these bits
+
+void delay_us(unsigned int howLong)
+{
+}
+
+void delay_ns(unsigned int howLong)
+{
+}
+
+void delay_bit_us(unsigned int howLong)
+{
+}
+
+void delay_bit_ns(unsigned int howLong)
+{
+}
+
+void realtime_worker(void)
+{
+}
+
+/* The ICSP decoder is shared, as the targets see the same PGC and MCLR */
+static struct {
+	enum {CMD, PAYLOAD, READ_IN, READ_OUT} state;
+	int bits;
+	uint16_t shift;
+	uint8_t cmd, w;
+	uint32_t tblptr;
+	bool clk, mclr, data;
+	std::vector<uint8_t> flash[TARGETS];
+	uint8_t out[TARGETS];		// byte being shifted out by TBLRD*+
+	bool data_out[TARGETS];
+} sim;
+
+static void target_program(uint32_t addr, uint8_t byte)
+{
+	uint8_t stuck = 0;
+
+	for (int t = 0; t < TARGETS; t++) {
+		if (t == 2)
+			continue;
+		stuck = (t == 0 && addr == STUCK_ADDR) ? STUCK_BITS : 0;
+		sim.flash[t][addr] &= byte | stuck;
+	}
+}
+
+static void target_execute(uint8_t cmd, uint16_t op)
+{
+	switch (cmd) {
+		case 0x0:		// core instruction
+			if ((op & 0xFF00) == 0x0E00)		// MOVLW
+				sim.w = op & 0xFF;
+			else if (op == 0x6EF8)				// MOVWF TBLPTRU
+				sim.tblptr = (sim.tblptr & 0x00FFFF) | sim.w << 16;
+			else if (op == 0x6EF7)				// MOVWF TBLPTRH
+				sim.tblptr = (sim.tblptr & 0xFF00FF) | sim.w << 8;
+			else if (op == 0x6EF6)				// MOVWF TBLPTRL
+				sim.tblptr = (sim.tblptr & 0xFFFF00) | sim.w;
+			break;
+		case 0xC:		// table write: the bulk erase key
+			if (sim.tblptr == 0x3C0004 && op == 0x0180)
+				for (int t = 0; t < 2; t++)
+					for (uint32_t a = 0; a < 0x4000; a++)
+						sim.flash[t][a] = 0xFF;
+			break;
+		case 0xD:		// table write, post-increment by 2
+		case 0xF:		// table write, start programming
+			target_program(sim.tblptr, op & 0xFF);
+			target_program(sim.tblptr + 1, op >> 8);
+			if (cmd == 0xD)
+				sim.tblptr += 2;
+			break;
+	}
+}
+
+static void target_falling(void)
+{
+	switch (sim.state) {
+		case sim.CMD:
+			sim.shift |= sim.data << sim.bits;
+			if (++sim.bits < 4)
+				return;
+			sim.cmd = sim.shift;
+			if (sim.cmd == 0x9) {		// TBLRD*+
+				for (int t = 0; t < TARGETS; t++)
+					sim.out[t] = sim.flash[t][sim.tblptr];
+				sim.tblptr++;
+				sim.state = sim.READ_IN;
+			}
+			else
+				sim.state = sim.PAYLOAD;
+			break;
+		case sim.PAYLOAD:
+			sim.shift |= sim.data << sim.bits;
+			if (++sim.bits < 16)
+				return;
+			target_execute(sim.cmd, sim.shift);
+			sim.state = sim.CMD;
+			break;
+		case sim.READ_IN:
+			if (++sim.bits < 8)
+				return;
+			sim.state = sim.READ_OUT;
+			break;
+		case sim.READ_OUT:
+			if (++sim.bits < 8)
+				return;
+			sim.state = sim.CMD;
+			break;
+	}
+	sim.bits = 0;
+	sim.shift = 0;
+}
+
+static void target_clk(bool level)
+{
+	if (level == sim.clk)
+		return;
+	sim.clk = level;
+	if (!sim.mclr)				// key sequence, not decoded here
+		return;
+	if (level && sim.state == sim.READ_OUT)
+		for (int t = 0; t < TARGETS; t++)
+			sim.data_out[t] = (sim.out[t] >> sim.bits) & 0x1;
+	if (!level)
+		target_falling();
+}
+
+static void target_mclr(bool level)
+{
+	sim.mclr = level;
+	sim.state = sim.CMD;
+	sim.bits = 0;
+	sim.shift = 0;
+}
+
+void gpio_sim::resolve(gpio_pin &p)
+{
+	p.shift = p.num;
+	p.mask = 1 << p.num;
+}
+
+void gpio_sim::in(const gpio_pin &p)
+{
+}
+
+void gpio_sim::out(const gpio_pin &p)
+{
+}
+
+void gpio_sim::set(const gpio_pin &p)
+{
+	if (&p == &pic_clk)
+		target_clk(true);
+	else if (&p == &pic_mclr)
+		target_mclr(true);
+	else if (&p == &pic_data)
+		sim.data = true;
+}
+
+void gpio_sim::clr(const gpio_pin &p)
+{
+	if (&p == &pic_clk)
+		target_clk(false);
+	else if (&p == &pic_mclr)
+		target_mclr(false);
+	else if (&p == &pic_data)
+		sim.data = false;
+}
+
+/* One level word for all the PGD lines, as the BCM283x backend reads it */
+uint32_t gpio_sim::lev(const gpio_pin &p)
+{
+	uint32_t levels = 0;
+
+	for (int t = 0; t < TARGETS; t++)
+		levels |= sim.data_out[t] << pgd[t];
+	if (p.gang)
+		gang_sample(levels);
+	return (levels >> p.shift) & 0x1;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failures++;
+}
+
+/* Target t (from 0) failed failed words of words, the first at first */
+static bool target_is(int t, unsigned long failed, unsigned long words,
+		uint32_t first)
+{
+	unsigned long w;
+	uint32_t f;
+
+	if (gang_failures(t, w, f) != failed || w != words)
+		return false;
+	return failed == 0 || f == first;
+}
+
+/* Image of IMAGE_WORDS words from 0, as an Intel HEX file */
+static void write_image(const char *name)
+{
+	FILE *fp = fopen(name, "w");
+	uint8_t bytes[16], sum;
+
+	for (int addr = 0; addr < IMAGE_WORDS*2; addr += 16) {
+		for (int i = 0; i < 16; i += 2) {
+			uint16_t word = 0x1000 + (addr + i)/2 * 0x0101;
+			bytes[i] = word & 0xFF;
+			bytes[i+1] = word >> 8;
+		}
+		sum = 16 + (addr >> 8) + (addr & 0xFF);
+		fprintf(fp, ":10%04X00", addr);
+		for (int i = 0; i < 16; i++) {
+			fprintf(fp, "%02X", bytes[i]);
+			sum += bytes[i];
+		}
+		fprintf(fp, "%02X\n", (uint8_t)-sum);
+	}
+	fprintf(fp, ":00000001FF\n");
+	fclose(fp);
+}
+
+int main(void)
+{
+	char image[] = "/tmp/gang_test_XXXXXX";
+	char readback[] = "/tmp/gang_test_XXXXXX";
+	pic18fj pic;
+	char list[32];
+
+	close(mkstemp(image));
+	close(mkstemp(readback));
+	write_image(image);
+	flags.no_image_cache = 1;
+
+	for (int t = 0; t < TARGETS; t++) {
+		sim.flash[t].assign(0x400000, 0xFF);
+		sim.flash[t][0x3FFFFE] = DEVICE_ID & 0xFF;
+		sim.flash[t][0x3FFFFF] = DEVICE_ID >> 8;
+	}
+	sim.flash[2][0x100] = 0x00;		// target 3: not blank, never erased
+
+	snprintf(list, sizeof(list), "%d+%d+%d", pgd[0], pgd[1], pgd[2]);
+	check(gang_parse(list, pic_data) && gang_targets() == TARGETS,
+			"three targets parsed");
+	gpio_backend::resolve(pic_data);
+	gang_resolve(pic_data);
+
+	pic.enter_program_mode();
+	check(pic.read_device_id(), "device ID read");
+
+	gang_reset();
+	pic.write(image);
+	check(target_is(0, 1, IMAGE_WORDS*2, STUCK_ADDR),
+			"write: target 1 fails at the byte that did not program");
+	check(target_is(1, 0, IMAGE_WORDS*2, 0),
+			"write: target 2 verified in full after target 1 failed");
+	check(target_is(2, IMAGE_WORDS*2, IMAGE_WORDS*2, 0),
+			"write: target 3 fails from the first byte");
+	gang_report();
+
+	gang_reset();
+	pic.bulk_erase();
+	pic.blank_check();
+	check(target_is(0, 0, (0x2000-4)*2, 0) &&
+			target_is(1, 0, (0x2000-4)*2, 0),
+			"blank check: targets 1 and 2 erased");
+	check(target_is(2, 1, (0x2000-4)*2, 0x100),
+			"blank check: target 3 not blank at 0x100");
+	gang_report();
+
+	gang_reset();
+	check(pic.read(readback, 0, 0), "read: hex file written");
+	check(target_is(0, 0, 0, 0) && target_is(2, 0, 0, 0),
+			"read: no target checked, status polling and data not compared");
+	gang_report();
+
+	check(!pic.read((char *)"/dev/full", 0, 0),
+			"read: write error on the hex file reported");
+	check(!pic.read((char *)"/nonexistent/readback.hex", 0, 0),
+			"read: hex file that cannot be opened reported");
+
+	unlink(image);
+	unlink(readback);
+
+	printf("%s\n", failures ? "FAILED" : "All tests passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GPIO_H_
+#define GPIO_H_
+
+#include <stdint.h>
+
+extern volatile uint32_t *gpio;
+
+/*
+ * Host-side shadow of the GPIO configuration and data registers (gpio.cpp).
+ * Backends keep here the last value written to a register, so changing one
+ * pin is a plain store instead of a read-modify-write over the (slow)
+ * peripheral bus, and a store that would not change anything is skipped.
+ * Each shadowed word is read from the hardware once, the first time it is
+ * used after gpio_shadow_reset(); picberry must then be the only user of
+ * the shadowed registers while it runs.
+ */
+#define GPIO_SHADOW_WORDS	64
+
+extern uint32_t gpio_shadow[GPIO_SHADOW_WORDS];
+extern uint64_t gpio_shadow_valid;
+
+void gpio_shadow_reset(void);
+
+/* Value of shadow word i, mirroring register reg */
+static inline uint32_t gpio_shadow_get(int i, volatile uint32_t *reg)
+{
+	if (__builtin_expect(!(gpio_shadow_valid & (1ULL << i)), 0)) {
+		gpio_shadow[i] = *reg;
+		gpio_shadow_valid |= 1ULL << i;
+	}
+	return gpio_shadow[i];
+}
+
+/* Write v to register reg through shadow word i */
+static inline void gpio_shadow_put(int i, volatile uint32_t *reg, uint32_t v)
+{
+	if (v != gpio_shadow[i]) {
+		gpio_shadow[i] = v;
+		*reg = v;
+	}
+}
+
+/*
+ * A GPIO line, resolved once by the backend (in setup_io()) into register
+ * addresses, shadow words and masks, so that the accessors used in the
+ * bit-banging loops do no address arithmetic at all. num is the gpio as
+ * selected by the user, in [PORT:]NUM form (a line offset with --gpiochip).
+ */
+struct gpio_pin {
+	int num;
+	volatile uint32_t *dir_reg;	// direction (function select) register
+	int dir_shadow;				// shadow word of dir_reg
+	uint32_t dir_mask;			// direction field of the pin in dir_reg
+	uint32_t dir_in, dir_out;	// field values for input and output
+	volatile uint32_t *set_reg;	// drives the pin high
+	volatile uint32_t *clr_reg;	// drives the pin low
+	int data_shadow;			// shadow word of set_reg, if read-modify-write
+	volatile uint32_t *lev_reg;	// pin level register
+	uint32_t mask;				// pin bit in set_reg, clr_reg and lev_reg
+	int shift;					// position of mask
+	gpio_pin *gang;				// next PGD line in gang mode (gang.cpp)
+
+	gpio_pin(int g = 0) : num(g), dir_reg(0), dir_shadow(0), dir_mask(0),
+		dir_in(0), dir_out(0), set_reg(0), clr_reg(0), data_shadow(-1),
+		lev_reg(0), mask(0), shift(0), gang(0) {}
+};
+
+/*
+ * Gang mode (gang.cpp): every PGD level register read is handed to
+ * gang_sample(); the read primitives bracket the data bits of a word with
+ * gang_word_begin() and gang_word_end(), so it is assembled per target.
+ */
+void gang_sample(uint32_t levels);
+void gang_word_begin(void);
+void gang_word_end(void);
+
+/* Set the direction field of pin p to v, through its shadow word */
+static inline void gpio_pin_dir(const gpio_pin &p, uint32_t v)
+{
+	uint32_t dir = gpio_shadow_get(p.dir_shadow, p.dir_reg);
+
+	gpio_shadow_put(p.dir_shadow, p.dir_reg, (dir & ~p.dir_mask) | v);
+}
+
+static inline uint32_t gpio_pin_lev(const gpio_pin &p)
+{
+	return (*p.lev_reg >> p.shift) & 0x1;
+}
+
+/*
+ * Each host header provides a GPIO backend: a policy class with a static
+ * resolve(p) filling a gpio_pin, and static inline in(p), out(p), set(p),
+ * clr(p) and lev(p) members operating on it, named by GPIO_HOST. The
+ * drivers are compiled against gpio_backend, so every GPIO_* call below
+ * inlines to the register access of the chosen backend (behind a single
+ * predictable branch for the run-time cdev selection). A different backend
+ * (e.g. a simulated target) can be swapped in by building with
+ * -DGPIO_BACKEND=<class>.
+ */
+#if defined(BOARD_A10)
+#include "hosts/a10.h"
+#elif defined(BOARD_RPI)
+#include "hosts/rpi.h"
+#elif defined(BOARD_RPI2)
+#include "hosts/rpi2.h"
+#elif defined(BOARD_AM335X)
+#include "hosts/am335x.h"
+#endif
+
+/*
+ * Linux GPIO character device backend (gpio_cdev.cpp). It is selected at
+ * run time with --gpiochip, in which case pins are line offsets on that
+ * gpiochip and no /dev/mem mapping is needed.
+ */
+extern bool gpio_cdev_active;
+extern char *gpiochip;		// gpiochip device given with --gpiochip, if any
+
+struct gpio_cdev {
+	static bool open(const char *chip, int clk, int data, int mclr);
+	static void close(void);
+	static void in(int g);
+	static void out(int g);
+	static void set(int g);
+	static void clr(int g);
+	static uint32_t lev(int g);
+
+	/* line offset of a [PORT:]NUM pin, ports being 32 lines apart */
+	static inline int line_offset(int g)
+	{
+#if PORTOFFSET
+		return ((g>>8)/PORTOFFSET)*32 + (g&0xFF);
+#else
+		return g&0xFF;
+#endif
+	}
+};
+
+/* Forward to the character device backend when active, else to Host */
+template <class Host>
+struct gpio_dispatch {
+	static inline void resolve(gpio_pin &p)
+	{
+		if (!gpio_cdev_active) Host::resolve(p);
+	}
+	static inline void in(const gpio_pin &p)
+	{
+		if (__builtin_expect(gpio_cdev_active, 0)) gpio_cdev::in(p.num);
+		else Host::in(p);
+	}
+	static inline void out(const gpio_pin &p)
+	{
+		if (__builtin_expect(gpio_cdev_active, 0)) gpio_cdev::out(p.num);
+		else Host::out(p);
+	}
+	static inline void set(const gpio_pin &p)
+	{
+		if (__builtin_expect(gpio_cdev_active, 0)) gpio_cdev::set(p.num);
+		else Host::set(p);
+	}
+	static inline void clr(const gpio_pin &p)
+	{
+		if (__builtin_expect(gpio_cdev_active, 0)) gpio_cdev::clr(p.num);
+		else Host::clr(p);
+	}
+	static inline uint32_t lev(const gpio_pin &p)
+	{
+		if (__builtin_expect(gpio_cdev_active, 0)) return gpio_cdev::lev(p.num);
+		return Host::lev(p);
+	}
+};
+
+#ifndef GPIO_BACKEND
+#define GPIO_BACKEND	gpio_dispatch<GPIO_HOST>
+#endif
+
+typedef GPIO_BACKEND gpio_backend;
+
+/* GPIO access as used by the device drivers, g being a resolved gpio_pin */
+#define GPIO_IN(g)		gpio_backend::in(g)
+#define GPIO_OUT(g)		gpio_backend::out(g)
+#define GPIO_SET(g)		gpio_backend::set(g)
+#define GPIO_CLR(g)		gpio_backend::clr(g)
+#define GPIO_LEV(g)		gpio_backend::lev(g)
+
+#endif /* GPIO_H_ */
@@ -0,0 +1,228 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio.h"
+
+/*
+ * GPIO backend on top of the Linux GPIO character device (uAPI v2).
+ *
+ * PGC, PGD and MCLR are requested together as a single line request, so
+ * several lines can be changed by one GPIO_V2_LINE_SET_VALUES_IOCTL and
+ * all directions are reconfigured by one GPIO_V2_LINE_SET_CONFIG_IOCTL.
+ *
+ * Writes to PGD are held back and issued together with the next rising
+ * edge of PGC: all the supported ICSP protocols sample PGD on the falling
+ * edge, so this halves the number of ioctls per bit without changing what
+ * the target sees. Any other operation flushes a pending PGD write first.
+ */
+
+bool gpio_cdev_active = false;
+
+#define CDEV_MAX_LINES	3
+
+static int req_fd = -1;
+static int lines[CDEV_MAX_LINES];
+static int nlines = 0;
+static int clk_idx = -1, data_idx = -1;
+
+static uint64_t out_mask = 0;		// lines configured as outputs
+static uint64_t values = 0;			// last value written to each line
+static uint64_t pending_mask = 0;	// PGD writes not yet issued
+
+static inline uint64_t line_bit(int g)
+{
+	for (int i = 0; i < nlines; i++)
+		if (lines[i] == g)
+			return 1ULL << i;
+	return 0;
+}
+
+static void write_values(uint64_t mask)
+{
+	struct gpio_v2_line_values lv;
+
+	lv.mask = mask & out_mask;
+	lv.bits = values;
+	if (lv.mask && ioctl(req_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &lv) < 0)
+		perror("GPIO_V2_LINE_SET_VALUES_IOCTL");
+}
+
+static inline void flush(void)
+{
+	if (pending_mask) {
+		write_values(pending_mask);
+		pending_mask = 0;
+	}
+}
+
+/* Apply direction (and initial output level) of all lines at once */
+static void write_config(void)
+{
+	struct gpio_v2_line_config config;
+
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if (out_mask) {
+		config.num_attrs = 2;
+		config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+		config.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+		config.attrs[0].mask = out_mask;
+		config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		config.attrs[1].attr.values = values;
+		config.attrs[1].mask = out_mask;
+	}
+	if (ioctl(req_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+		perror("GPIO_V2_LINE_SET_CONFIG_IOCTL");
+}
+
+static inline void write_line(int g, bool level)
+{
+	uint64_t bit = line_bit(g);
+
+	if (level)
+		values |= bit;
+	else
+		values &= ~bit;
+
+	if (!(bit & out_mask))
+		return;		// applied when the line is switched to output
+
+	if (data_idx >= 0 && bit == (1ULL << data_idx)) {
+		pending_mask |= bit;
+		return;
+	}
+
+	if (level && clk_idx >= 0 && bit == (1ULL << clk_idx)) {
+		write_values(bit | pending_mask);
+		pending_mask = 0;
+		return;
+	}
+
+	flush();
+	write_values(bit);
+}
+
+/*
+ * Request the given line offsets (a negative offset is skipped) on the
+ * gpiochip device, all as inputs. Returns false on error.
+ */
+bool gpio_cdev::open(const char *chip, int clk, int data, int mclr)
+{
+	struct gpio_v2_line_request req;
+	const int requested[CDEV_MAX_LINES] = {clk, data, mclr};
+	int chip_fd;
+
+	memset(&req, 0, sizeof(req));
+	nlines = 0;
+	clk_idx = data_idx = -1;
+	for (int i = 0; i < CDEV_MAX_LINES; i++) {
+		if (requested[i] < 0)
+			continue;
+		if (i == 0) clk_idx = nlines;
+		if (i == 1) data_idx = nlines;
+		lines[nlines] = requested[i];
+		req.offsets[nlines++] = requested[i];
+	}
+	req.num_lines = nlines;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	strncpy(req.consumer, "picberry", sizeof(req.consumer)-1);
+
+	chip_fd = ::open(chip, O_RDWR|O_CLOEXEC);
+	if (chip_fd < 0) {
+		perror("Cannot open gpiochip");
+		return false;
+	}
+	if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+		perror("GPIO_V2_GET_LINE_IOCTL");
+		::close(chip_fd);
+		return false;
+	}
+	::close(chip_fd);
+
+	req_fd = req.fd;
+	out_mask = values = pending_mask = 0;
+	gpio_cdev_active = true;
+
+	return true;
+}
+
+void gpio_cdev::close(void)
+{
+	if (req_fd < 0)
+		return;
+	flush();
+	::close(req_fd);	// released lines go back to input
+	req_fd = -1;
+	gpio_cdev_active = false;
+}
+
+void gpio_cdev::in(int g)
+{
+	uint64_t bit = line_bit(g);
+
+	flush();
+	if (!(out_mask & bit))
+		return;
+	out_mask &= ~bit;
+	write_config();
+}
+
+void gpio_cdev::out(int g)
+{
+	uint64_t bit = line_bit(g);
+
+	flush();
+	if (out_mask & bit)
+		return;
+	out_mask |= bit;
+	write_config();
+}
+
+void gpio_cdev::set(int g)
+{
+	write_line(g, true);
+}
+
+void gpio_cdev::clr(int g)
+{
+	write_line(g, false);
+}
+
+uint32_t gpio_cdev::lev(int g)
+{
+	struct gpio_v2_line_values lv;
+
+	flush();
+	lv.mask = line_bit(g);
+	lv.bits = 0;
+	if (ioctl(req_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lv) < 0) {
+		perror("GPIO_V2_LINE_GET_VALUES_IOCTL");
+		return 0;
+	}
+	return (lv.bits & lv.mask) ? 1 : 0;
+}
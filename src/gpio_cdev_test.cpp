@@ -0,0 +1,238 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include <vector>
+
+#include "gpio.h"
+
+/*
+ * Tests of the GPIO character device backend (gpio_cdev.cpp) against a
+ * mocked ioctl(): the ioctls issued by the backend are recorded instead of
+ * reaching a gpiochip, and checked for the line request, the batching of
+ * direction changes and the merging of a PGD write with the next rising
+ * edge of PGC. Run with `make test`.
+ */
+
+char *gpiochip = 0;
+
+#define CLK		23
+#define DATA	24
+#define MCLR	18
+
+/* line bits in the request, in the order requested (PGC, PGD, MCLR) */
+#define CLK_BIT		(1ULL << 0)
+#define DATA_BIT	(1ULL << 1)
+#define MCLR_BIT	(1ULL << 2)
+
+struct mock_call {
+	unsigned long request;
+	uint64_t mask;		// lines written, read or configured as outputs
+	uint64_t bits;		// values written (or output values configured)
+};
+
+static std::vector<mock_call> calls;
+static struct gpio_v2_line_request last_req;
+static uint64_t input_levels;	// returned by GPIO_V2_LINE_GET_VALUES_IOCTL
+static int req_fd = -1;
+
+/* Replaces the libc ioctl() for the whole test program */
+extern "C" int ioctl(int fd, unsigned long request, ...)
+{
+	struct gpio_v2_line_request *req;
+	struct gpio_v2_line_config *config;
+	struct gpio_v2_line_values *lv;
+	mock_call c = {request, 0, 0};
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	switch (request) {
+		case GPIO_V2_GET_LINE_IOCTL:
+			req = (struct gpio_v2_line_request *)arg;
+			last_req = *req;
+			req_fd = req->fd = ::open("/dev/null", O_RDONLY);
+			break;
+		case GPIO_V2_LINE_SET_CONFIG_IOCTL:
+			config = (struct gpio_v2_line_config *)arg;
+			for (unsigned int i = 0; i < config->num_attrs; i++) {
+				if (config->attrs[i].attr.id == GPIO_V2_LINE_ATTR_ID_FLAGS &&
+						config->attrs[i].attr.flags == GPIO_V2_LINE_FLAG_OUTPUT)
+					c.mask = config->attrs[i].mask;
+				if (config->attrs[i].attr.id ==
+						GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES)
+					c.bits = config->attrs[i].attr.values &
+							config->attrs[i].mask;
+			}
+			break;
+		case GPIO_V2_LINE_SET_VALUES_IOCTL:
+			lv = (struct gpio_v2_line_values *)arg;
+			c.mask = lv->mask;
+			c.bits = lv->bits & lv->mask;
+			break;
+		case GPIO_V2_LINE_GET_VALUES_IOCTL:
+			lv = (struct gpio_v2_line_values *)arg;
+			c.mask = lv->mask;
+			lv->bits = input_levels & lv->mask;
+			break;
+		default:
+			return -1;
+	}
+	if (fd != req_fd && request != GPIO_V2_GET_LINE_IOCTL)
+		return -1;
+	calls.push_back(c);
+	return 0;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failures++;
+}
+
+static bool call_is(size_t i, unsigned long request, uint64_t mask,
+		uint64_t bits)
+{
+	return i < calls.size() && calls[i].request == request &&
+			calls[i].mask == mask && calls[i].bits == bits;
+}
+
+static void test_request(void)
+{
+	calls.clear();
+	check(gpio_cdev::open("/dev/null", CLK, DATA, MCLR) && gpio_cdev_active,
+			"open requests the lines");
+	check(calls.size() == 1 && calls[0].request == GPIO_V2_GET_LINE_IOCTL,
+			"one GPIO_V2_GET_LINE_IOCTL for all the lines");
+	check(last_req.num_lines == 3 && last_req.offsets[0] == CLK &&
+			last_req.offsets[1] == DATA && last_req.offsets[2] == MCLR,
+			"PGC, PGD and MCLR in one request");
+	check(last_req.config.flags == GPIO_V2_LINE_FLAG_INPUT,
+			"lines requested as inputs");
+	check(!strcmp(last_req.consumer, "picberry"), "consumer label");
+	gpio_cdev::close();
+
+	calls.clear();
+	gpio_cdev::open("/dev/null", CLK, -1, MCLR);
+	check(last_req.num_lines == 2 && last_req.offsets[0] == CLK &&
+			last_req.offsets[1] == MCLR, "negative offsets are skipped");
+	gpio_cdev::close();
+}
+
+static void test_direction(void)
+{
+	gpio_cdev::open("/dev/null", CLK, DATA, MCLR);
+
+	calls.clear();
+	gpio_cdev::set(MCLR);
+	check(calls.empty(), "no write to an input line");
+	gpio_cdev::out(MCLR);
+	check(calls.size() == 1 && call_is(0, GPIO_V2_LINE_SET_CONFIG_IOCTL,
+			MCLR_BIT, MCLR_BIT), "output level applied with the direction");
+	gpio_cdev::out(CLK);
+	gpio_cdev::out(DATA);
+	check(call_is(2, GPIO_V2_LINE_SET_CONFIG_IOCTL,
+			CLK_BIT | DATA_BIT | MCLR_BIT, MCLR_BIT),
+			"all directions in each SET_CONFIG");
+	calls.clear();
+	gpio_cdev::out(DATA);
+	check(calls.empty(), "no ioctl when the direction does not change");
+
+	gpio_cdev::close();
+}
+
+static void test_merge(void)
+{
+	gpio_cdev::open("/dev/null", CLK, DATA, MCLR);
+	gpio_cdev::out(CLK);
+	gpio_cdev::out(DATA);
+
+	calls.clear();
+	gpio_cdev::set(DATA);
+	check(calls.empty(), "PGD write held back");
+	gpio_cdev::set(CLK);
+	check(calls.size() == 1 && call_is(0, GPIO_V2_LINE_SET_VALUES_IOCTL,
+			CLK_BIT | DATA_BIT, CLK_BIT | DATA_BIT),
+			"PGD write issued with the PGC rising edge");
+
+	calls.clear();
+	gpio_cdev::clr(DATA);
+	gpio_cdev::clr(CLK);
+	check(calls.size() == 2 &&
+			call_is(0, GPIO_V2_LINE_SET_VALUES_IOCTL, DATA_BIT, 0) &&
+			call_is(1, GPIO_V2_LINE_SET_VALUES_IOCTL, CLK_BIT, 0),
+			"PGD write flushed before a PGC falling edge");
+
+	calls.clear();
+	gpio_cdev::set(DATA);
+	gpio_cdev::clr(DATA);
+	gpio_cdev::set(CLK);
+	check(calls.size() == 1 && call_is(0, GPIO_V2_LINE_SET_VALUES_IOCTL,
+			CLK_BIT | DATA_BIT, CLK_BIT),
+			"only the last held back PGD level is issued");
+
+	calls.clear();
+	gpio_cdev::set(DATA);
+	input_levels = DATA_BIT;
+	check(gpio_cdev::lev(DATA) == 1, "level read");
+	check(calls.size() == 2 &&
+			call_is(0, GPIO_V2_LINE_SET_VALUES_IOCTL, DATA_BIT, DATA_BIT) &&
+			call_is(1, GPIO_V2_LINE_GET_VALUES_IOCTL, DATA_BIT, 0),
+			"PGD write flushed before a read");
+
+	calls.clear();
+	gpio_cdev::clr(DATA);
+	gpio_cdev::in(DATA);
+	check(calls.size() == 2 &&
+			call_is(0, GPIO_V2_LINE_SET_VALUES_IOCTL, DATA_BIT, 0) &&
+			call_is(1, GPIO_V2_LINE_SET_CONFIG_IOCTL, CLK_BIT, CLK_BIT),
+			"PGD write flushed before a direction change");
+
+	calls.clear();
+	gpio_cdev::out(DATA);
+	gpio_cdev::set(DATA);
+	gpio_cdev::close();
+	check(call_is(1, GPIO_V2_LINE_SET_VALUES_IOCTL, DATA_BIT, DATA_BIT) &&
+			!gpio_cdev_active, "PGD write flushed on close");
+}
+
+int main(void)
+{
+	test_request();
+	test_direction();
+	test_merge();
+
+	printf("%s\n", failures ? "FAILED" : "All tests passed");
+	return failures ? 1 : 0;
+}
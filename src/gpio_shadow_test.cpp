@@ -0,0 +1,98 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define GPIO_BACKEND	gpio_bcm2835	// no run-time cdev dispatch
+#include "gpio.h"
+
+/*
+ * Tests of the register shadow (gpio.cpp) through the Raspberry Pi backend,
+ * with a plain array standing in for the GPIO block: a register changed
+ * behind the backend's back shows whether it was read again, or written.
+ * Run with `make test`.
+ */
+
+static uint32_t regs[64];
+volatile uint32_t *gpio = regs;
+
+void gang_sample(uint32_t levels)
+{
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failures++;
+}
+
+int main(void)
+{
+	gpio_pin clk(23), data(24), mclr(18);
+
+	memset(regs, 0, sizeof(regs));
+	regs[2] = 0x00000007;		// GPIO20 in an alternate function
+	regs[1] = 0x3F000000;		// GPIO18 in an alternate function
+	gpio_shadow_reset();
+	gpio_backend::resolve(clk);
+	gpio_backend::resolve(data);
+	gpio_backend::resolve(mclr);
+
+	GPIO_OUT(clk);
+	check(regs[2] == (0x00000007 | 1 << 9),
+			"function select read once and only the pin field changed");
+
+	regs[2] |= 0x00000038;		// GPIO21 changed behind the backend's back
+	GPIO_OUT(data);
+	check(regs[2] == (0x00000007 | 1 << 9 | 1 << 12),
+			"function select taken from the shadow, not read again");
+
+	regs[2] = 0;
+	GPIO_OUT(data);
+	check(regs[2] == 0, "write that changes nothing is skipped");
+
+	GPIO_IN(data);
+	check(regs[2] == (0x00000007 | 1 << 9),
+			"direction change writes the shadowed word");
+
+	GPIO_OUT(mclr);
+	check(regs[1] == (0x3F000000 & ~(7 << 24)) + (1 << 24),
+			"each register has its own shadow word");
+
+	gpio_shadow_reset();
+	regs[2] = 0;
+	GPIO_OUT(clk);
+	check(regs[2] == 1 << 9, "register read again after gpio_shadow_reset()");
+
+	GPIO_SET(clk);
+	check(regs[7] == 1 << 23, "set through GPSET");
+	GPIO_CLR(data);
+	check(regs[10] == 1 << 24, "clear through GPCLR");
+	regs[13] = 1 << 24;
+	check(GPIO_LEV(data) == 1 && GPIO_LEV(clk) == 0, "level through GPLEV");
+
+	printf("%s\n", failures ? "FAILED" : "All tests passed");
+	return failures ? 1 : 0;
+}
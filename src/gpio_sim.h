@@ -0,0 +1,46 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GPIO_SIM_H_
+#define GPIO_SIM_H_
+
+#include <stdint.h>
+
+/*
+ * GPIO backend for the tests: every pin access of the code under test is
+ * handed to a simulated target, which the test program implements by
+ * defining the members below (resolve() may just set the pin's bit in the
+ * level word handed to gang_sample()). Code is built against it with
+ * `-include src/gpio_sim.h` (see the test rules in the Makefile).
+ */
+struct gpio_pin;
+
+struct gpio_sim {
+	static void resolve(gpio_pin &p);
+	static void in(const gpio_pin &p);
+	static void out(const gpio_pin &p);
+	static void set(const gpio_pin &p);
+	static void clr(const gpio_pin &p);
+	static uint32_t lev(const gpio_pin &p);
+};
+
+#define GPIO_BACKEND	gpio_sim
+
+#endif /* GPIO_SIM_H_ */
@@ -35,34 +35,50 @@
 
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
 
 #include "common.h"
+#include "waveform.h"
 
 int                 mem_fd;
 void                *gpio_map;
 volatile uint32_t   *gpio;
-
-void setup_io(void);
-void close_io(void);
+char                *gpiochip = 0;  // if set, use this GPIO character device
 
 struct flags_struct flags;
 
-int tested_gpio = DEFAULT_PIC_CLK;
+void delay_benchmark(void);
+void edge_benchmark(void);
+void image_benchmark(void);
+void hex_benchmark(char *file);
+
+gpio_pin tested_gpio = DEFAULT_PIC_CLK;
 char tested_gpio_port = 0;
 
+/* used by the waveform replay benchmark, both set to the tested gpio */
+gpio_pin pic_clk, pic_data, pic_mclr;
+
 int main(int argc, char *argv[])
 {
-    char *pins = 0;
+    char *pins = 0, *hex_file = 0;
     int opt = 0, option_index = 0;
+    bool timing = false, bench = false, image_bench = false;
 
     static struct option long_options[] = {
             {"debug", 0, 0, 'D'},
-            {"gpio", 1, 0, 'g'}
+            {"gpio", 1, 0, 'g'},
+            {"timing", 0, 0, 't'},
+            {"bench", 0, 0, 'b'},
+            {"gpiochip", 1, 0, 'C'},
+            {"image-bench", 0, 0, 'm'},
+            {"hex-bench", 1, 0, 'x'},
+            {0, 0, 0, 0}
     };
     
     setvbuf(stdout, NULL, _IONBF, 1024);
 
-    while ((opt = getopt_long(argc, argv, "Dg:",long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "Dg:tbC:mx:",long_options, &option_index)) != -1) {
         switch (opt) {
         case 'D':
             flags.debug = 1;
@@ -70,6 +86,21 @@ int main(int argc, char *argv[])
         case 'g':
             pins = optarg;
             break;
+        case 't':
+            timing = true;
+            break;
+        case 'b':
+            bench = true;
+            break;
+        case 'C':
+            gpiochip = optarg;
+            break;
+        case 'm':
+            image_bench = true;
+            break;
+        case 'x':
+            hex_file = optarg;
+            break;
         default:
             cout << endl;
             exit(1);
@@ -79,21 +110,50 @@ int main(int argc, char *argv[])
     /* Configure GPIOs */
     if(pins != 0){       // if GPIO connections are specified in the options...
         if(!strchr(&pins[0],':'))   // port not specified
-            sscanf(&pins[0], "%d", &tested_gpio);
+            sscanf(&pins[0], "%d", &tested_gpio.num);
         else{                       // port specified
-            if(!sscanf(&pins[0], "%[A-Z]:%d", &tested_gpio_port, &tested_gpio)){
+            if(!sscanf(&pins[0], "%[A-Z]:%d", &tested_gpio_port, &tested_gpio.num)){
                         cout << "GPIO selection string not correctly formatted!" << endl;
                         exit(0);
                     }
-            tested_gpio |= ((tested_gpio_port-'A')*PORTOFFSET)<<8;
+            tested_gpio.num |= ((tested_gpio_port-'A')*PORTOFFSET)<<8;
         }
     }
+    if(gpiochip){
+        tested_gpio.num = gpio_cdev::line_offset(tested_gpio.num);
+        tested_gpio_port = 0;
+    }
     
-    cout << "Testing GPIO " << tested_gpio_port << (tested_gpio&0xFF) << endl;
-    cout << "BASE ADDRESS " << hex << GPIO_BASE << " + OFFSET " << hex << OFFSET(tested_gpio) << " = FINAL ADDRESS " << hex << GPIO_BASE + OFFSET(tested_gpio) << endl;
+    delay_init();
+
+    if(timing){
+        delay_benchmark();
+        return 0;
+    }
+
+    if(image_bench){
+        image_benchmark();
+        return 0;
+    }
+
+    if(hex_file){
+        hex_benchmark(hex_file);
+        return 0;
+    }
+
+    cout << "Testing GPIO " << tested_gpio_port << (tested_gpio.num&0xFF) << endl;
+#if defined(BOARD_AM335X)
+    if(!gpiochip)
+        cout << "BASE ADDRESS " << hex << GPIO_BASE << " + OFFSET " << hex << GPIO_HOST::bank(tested_gpio.num)*4 << " = FINAL ADDRESS " << hex << GPIO_BASE + GPIO_HOST::bank(tested_gpio.num)*4 << dec << endl;
+#endif
 
     setup_io();
-    
+
+    if(bench){
+        edge_benchmark();
+        close_io();
+        return 0;
+    }
     
     GPIO_IN(tested_gpio);   // NOTE: MUST use GPIO_IN before GPIO_OUT
     cout << "Read Test: level = " << (int)(GPIO_LEV(tested_gpio)) << endl;
@@ -126,9 +186,306 @@ int main(int argc, char *argv[])
     return 0;
 }
 
+/*
+ * Compare requested and achieved delay_ns() durations over a range of
+ * typical ICSP timings, printing a histogram of the overshoot ratio.
+ */
+void delay_benchmark(void)
+{
+    const unsigned int requested[] = {40, 80, 100, 200, 500, 1000, 5000,
+                                      15000, 100000};
+    const char *bucket_name[] = {"<1x", "1-1.5x", "1.5-2x", "2-4x", "4-8x",
+                                 ">8x"};
+    const int samples = 2000;
+    uint64_t t0, t1, overhead = ~0ULL;
+    vector<uint64_t> achieved(samples);
+
+    /* cost of the measurement itself, subtracted from every sample */
+    for(int k=0; k<samples; k++){
+        t0 = delay_now_ns();
+        t1 = delay_now_ns();
+        overhead = min(overhead, t1-t0);
+    }
+
+    cout << "Delay benchmark (" << samples << " samples each, "
+         << "measurement overhead " << overhead << " ns)" << endl << endl;
+    printf("%9s %9s %9s %9s %9s |", "requested", "min", "median", "p99", "max");
+    for(int b=0; b<6; b++)
+        printf(" %6s", bucket_name[b]);
+    printf("\n");
+
+    for(unsigned int r=0; r<sizeof(requested)/sizeof(requested[0]); r++){
+        int histogram[6] = {0, 0, 0, 0, 0, 0};
+
+        for(int k=0; k<samples; k++){
+            t0 = delay_now_ns();
+            delay_ns(requested[r]);
+            t1 = delay_now_ns();
+            achieved[k] = (t1-t0 > overhead) ? t1-t0-overhead : 0;
+
+            double ratio = (double)achieved[k]/requested[r];
+            if(ratio < 1.0)         histogram[0]++;
+            else if(ratio < 1.5)    histogram[1]++;
+            else if(ratio < 2.0)    histogram[2]++;
+            else if(ratio < 4.0)    histogram[3]++;
+            else if(ratio < 8.0)    histogram[4]++;
+            else                    histogram[5]++;
+        }
+        sort(achieved.begin(), achieved.end());
+
+        printf("%9u %9llu %9llu %9llu %9llu |", requested[r],
+               (unsigned long long)achieved[0],
+               (unsigned long long)achieved[samples/2],
+               (unsigned long long)achieved[samples*99/100],
+               (unsigned long long)achieved[samples-1]);
+        for(int b=0; b<6; b++)
+            printf(" %6d", histogram[b]);
+        printf("\n");
+    }
+}
+
+/*
+ * Toggle and sample the tested GPIO as fast as possible through the
+ * GPIO backend, reporting the achieved edge and read rates, and (with the
+ * mmap backends) the same loops written as raw register accesses, so the
+ * cost of the backend layer shows. Run it with and without --gpiochip to
+ * compare the mmap and character device paths.
+ */
+void edge_benchmark(void)
+{
+    /* every cdev access is a syscall, keep its run about as long */
+    const unsigned int edges = gpiochip ? 200000 : 2000000;
+    uint64_t t0, t1;
+    uint32_t level = 0;
+
+    GPIO_IN(tested_gpio);   // NOTE: MUST use GPIO_IN before GPIO_OUT
+    GPIO_OUT(tested_gpio);
+
+    t0 = delay_now_ns();
+    for(unsigned int k=0; k<edges/2; k++){
+        GPIO_SET(tested_gpio);
+        GPIO_CLR(tested_gpio);
+    }
+    t1 = delay_now_ns();
+    printf("Edge rate: %u edges in %llu us, %.1f ns/edge, %.2f Medges/s\n",
+           edges, (unsigned long long)(t1-t0)/1000,
+           (double)(t1-t0)/edges, edges*1000.0/(t1-t0));
+
+    /*
+     * Baseline: the same edges as plain stores to the resolved registers,
+     * as the old GPIO_SET/GPIO_CLR macros did (read-modify-write on hosts
+     * without set/clear registers), without the backend dispatch.
+     */
+    if(!gpio_cdev_active){
+        volatile uint32_t *set_reg = tested_gpio.set_reg;
+        volatile uint32_t *clr_reg = tested_gpio.clr_reg;
+        uint32_t mask = tested_gpio.mask;
+        uint64_t backend = t1-t0;
+
+        t0 = delay_now_ns();
+        if(tested_gpio.data_shadow < 0)
+            for(unsigned int k=0; k<edges/2; k++){
+                *set_reg = mask;
+                *clr_reg = mask;
+            }
+        else
+            for(unsigned int k=0; k<edges/2; k++){
+                *set_reg |= mask;
+                *clr_reg &= ~mask;
+            }
+        t1 = delay_now_ns();
+        printf("Raw register edge rate: %.1f ns/edge, %.2f Medges/s "
+               "(backend overhead %+.1f ns/edge)\n",
+               (double)(t1-t0)/edges, edges*1000.0/(t1-t0),
+               ((double)backend-(double)(t1-t0))/edges);
+        gpio_shadow_reset();    // the shadow did not see these stores
+    }
+
+    GPIO_IN(tested_gpio);
+
+    t0 = delay_now_ns();
+    for(unsigned int k=0; k<edges; k++)
+        level += GPIO_LEV(tested_gpio);
+    t1 = delay_now_ns();
+    printf("Read rate: %u reads in %llu us, %.1f ns/read (%u high)\n",
+           edges, (unsigned long long)(t1-t0)/1000,
+           (double)(t1-t0)/edges, level);
+
+    if(!gpio_cdev_active){
+        volatile uint32_t *lev_reg = tested_gpio.lev_reg;
+        int shift = tested_gpio.shift;
+        uint64_t backend = t1-t0;
+
+        level = 0;
+        t0 = delay_now_ns();
+        for(unsigned int k=0; k<edges; k++)
+            level += (*lev_reg >> shift) & 0x1;
+        t1 = delay_now_ns();
+        printf("Raw register read rate: %.1f ns/read "
+               "(backend overhead %+.1f ns/read, %u high)\n",
+               (double)(t1-t0)/edges,
+               ((double)backend-(double)(t1-t0))/edges, level);
+    }
+
+    /* pre-rendered SIX commands with no delays, PGC and PGD on one pin */
+    const icsp_timing no_delays = {0, 0, 0, 0, 0};
+    icsp_waveform wave(no_delays);
+    unsigned int runs;
+
+    for(int k=0; k<16; k++)
+        wave.six(0xBA1B96 ^ (k<<4));
+    runs = edges/wave.edges();
+
+    pic_clk = pic_data = tested_gpio;
+    GPIO_OUT(tested_gpio);
+
+    t0 = delay_now_ns();
+    for(unsigned int k=0; k<runs; k++)
+        wave.run();
+    t1 = delay_now_ns();
+    printf("Waveform replay: %u clock edges in %llu us, %.2f Medges/s\n",
+           runs*wave.edges(), (unsigned long long)(t1-t0)/1000,
+           runs*wave.edges()*1000.0/(t1-t0));
+}
+
+/*
+ * Time the fill map queries of the drivers on a sparse 2 MB PIC32MZ image
+ * (1024-word rows): row occupancy and filled word searches, one location
+ * at a time as the drivers used to do and with the word-wide scans.
+ */
+void image_benchmark(void)
+{
+    const uint32_t flash_words = 0x100000, row_words = 1024;
+    const int passes = 20;
+    memory mem;
+    uint32_t seed = 1, addr, len, rows, found;
+    uint64_t t0, t1, t2;
+
+    /* ~300 KB of code at the start, then small scattered extents */
+    mem.init(0x03000000);
+    for(addr = 0; addr < 0x26000; addr++)
+        mem.put(addr, addr);
+    for(int k=0; k<64; k++){
+        seed = seed*1103515245 + 12345;
+        addr = 0x26000 + (seed >> 8) % (flash_words - 0x26000 - 512);
+        len = 8 + (seed >> 20) % 504;
+        for(uint32_t i=0; i<len; i++)
+            mem.put(addr+i, i);
+    }
+    printf("Image: %u words filled in %u pages\n",
+           mem.count_filled(0, flash_words), mem.page_count());
+
+    /* row occupancy */
+    rows = 0;
+    t0 = delay_now_ns();
+    for(int p=0; p<passes; p++)
+        for(addr = 0; addr < flash_words; addr += row_words)
+            for(uint32_t i=0; i<row_words; i++)
+                if(mem.filled(addr+i)){
+                    rows++;
+                    break;
+                }
+    t1 = delay_now_ns();
+    found = 0;
+    for(int p=0; p<passes; p++)
+        for(addr = 0; addr < flash_words; addr += row_words)
+            if(mem.any_filled(addr, row_words))
+                found++;
+    t2 = delay_now_ns();
+    printf("Row scan: %u of %u rows used, %.1f ns/row per word, "
+           "%.1f ns/row word-wide\n", found/passes, flash_words/row_words,
+           (double)(t1-t0)/(passes*flash_words/row_words),
+           (double)(t2-t1)/(passes*flash_words/row_words));
+    if(rows != found)
+        printf("Row scan: MISMATCH (%u rows per word)\n", rows/passes);
+
+    /* walk all the filled words */
+    rows = 0;
+    t0 = delay_now_ns();
+    for(int p=0; p<passes; p++)
+        for(addr = 0; addr < mem.program_memory_size; addr++)
+            if(mem.filled(addr))
+                rows++;
+    t1 = delay_now_ns();
+    found = 0;
+    for(int p=0; p<passes; p++)
+        for(addr = mem.next_filled(0); addr < mem.program_memory_size;
+                addr = mem.next_filled(addr+1))
+            found++;
+    t2 = delay_now_ns();
+    printf("Filled walk: %.2f ms per word, %.2f ms with next_filled()\n",
+           (t1-t0)/1e6/passes, (t2-t1)/1e6/passes);
+    if(rows != found)
+        printf("Filled walk: MISMATCH (%u vs %u)\n", rows, found);
+}
+
+/*
+ * Time read_inhx() on a hex file, into an image covering the 32-bit
+ * address space of any family (PIC32 addresses included, no offset),
+ * parsing it and then from the image cache, then write_inhx() of the
+ * resulting image.
+ */
+void hex_benchmark(char *file)
+{
+    const int passes = 5;
+    memory mem;
+    unsigned int filled = 0;
+    uint64_t t0, t1, best = ~0ULL;
+
+    flags.no_image_cache = 1;
+    for(int p=0; p<passes; p++){
+        mem.init(0x10000000);
+        t0 = delay_now_ns();
+        filled = read_inhx(file, &mem);
+        t1 = delay_now_ns();
+        best = min(best, t1-t0);
+    }
+    printf("read_inhx: %u words in %.2f ms (best of %d), %.1f ns/word\n",
+           filled, best/1e6, passes, filled ? (double)best/filled : 0.0);
+
+    /* the first pass stores the image in the cache, the others load it */
+    flags.no_image_cache = 0;
+    best = ~0ULL;
+    for(int p=0; p<=passes; p++){
+        mem.init(0x10000000);
+        t0 = delay_now_ns();
+        filled = read_inhx(file, &mem);
+        t1 = delay_now_ns();
+        if(p > 0)
+            best = min(best, t1-t0);
+    }
+    printf("read_inhx, cached image: %.2f ms (best of %d), %.1f ns/word\n",
+           best/1e6, passes, filled ? (double)best/filled : 0.0);
+
+    /* and write the image back, with each record size */
+    const unsigned int record_sizes[] = {16, 32, 64, 255};
+    char outfile[] = "/tmp/picberry-bench.hex";
+
+    for(unsigned int r=0; r<sizeof(record_sizes)/sizeof(record_sizes[0]); r++){
+        inhx_record_size = record_sizes[r];
+        best = ~0ULL;
+        for(int p=0; p<passes; p++){
+            t0 = delay_now_ns();
+            write_inhx(&mem, outfile);
+            t1 = delay_now_ns();
+            best = min(best, t1-t0);
+        }
+        printf("write_inhx, %3u-byte records: %.2f ms (best of %d), "
+               "%.1f ns/word\n", record_sizes[r], best/1e6, passes,
+               filled ? (double)best/filled : 0.0);
+    }
+    unlink(outfile);
+}
+
 /* Set up a memory regions to access GPIO */
 void setup_io(void)
 {
+        if(gpiochip){
+                if(!gpio_cdev::open(gpiochip, tested_gpio.num, -1, -1))
+                        exit(1);
+                return;
+        }
+
         /* open /dev/mem */
         mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
         if (mem_fd == -1) {
@@ -145,7 +502,8 @@ void setup_io(void)
 
         /* Always use volatile pointer! */
         gpio = (volatile uint32_t *) gpio_map;
-
+        gpio_shadow_reset();
+        gpio_backend::resolve(tested_gpio);
 }
 
 /* Release GPIO memory region */
@@ -153,6 +511,11 @@ void close_io(void)
 {
         int ret;
 
+        if(gpiochip){
+                gpio_cdev::close();
+                return;
+        }
+
         /* munmap GPIO */
         ret = munmap(gpio_map, BLOCK_SIZE);
         if (ret == -1) {
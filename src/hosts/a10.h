@@ -39,13 +39,56 @@
 #define SET         0x10
 #define PULL        0x1C
 
-/* GPIO setup macros. Always use GPIO_IN(x) before using GPIO_OUT(x) */
-#define GPIO_IN(g)    *(int*)((char*)gpio+OFFSET+(g>>8)+(((int)(g&0xFF)/8)*4)) &= ~(0x07<<(((int)(g&0xFF)%8)*4))
-#define GPIO_OUT(g)   *(int*)((char*)gpio+OFFSET+(g>>8)+(((int)(g&0xFF)/8)*4)) |= (0x01<<(((int)(g&0xFF)%8)*4))
+/*
+ * GPIO backend for the Allwinner A10. Each port has 4 configuration
+ * registers and a data register, all shadowed: 5 shadow words per port.
+ */
+struct gpio_a10 {
+	static inline void resolve(gpio_pin &p)
+	{
+		int port = p.num>>8, n = p.num&0xFF;
+		volatile uint32_t *data;
+
+		p.dir_reg = (volatile uint32_t*)((char*)gpio+OFFSET+port+(n/8)*4);
+		p.dir_shadow = (port/PORTOFFSET)*5 + n/8;
+		p.dir_mask = 0x07<<((n%8)*4);
+		p.dir_in = 0;
+		p.dir_out = 0x01<<((n%8)*4);
+
+		data = (volatile uint32_t*)((char*)gpio+OFFSET+port+SET);
+		p.set_reg = p.clr_reg = p.lev_reg = data;
+		p.data_shadow = (port/PORTOFFSET)*5 + 4;
+		p.mask = 1<<n;
+		p.shift = n;
+	}
+
+	static inline void in(const gpio_pin &p)
+	{
+		gpio_pin_dir(p, p.dir_in);
+	}
+	static inline void out(const gpio_pin &p)
+	{
+		gpio_pin_dir(p, p.dir_out);
+	}
+	static inline void set(const gpio_pin &p)
+	{
+		uint32_t data = gpio_shadow_get(p.data_shadow, p.set_reg);
+
+		gpio_shadow_put(p.data_shadow, p.set_reg, data | p.mask);
+	}
+	static inline void clr(const gpio_pin &p)
+	{
+		uint32_t data = gpio_shadow_get(p.data_shadow, p.clr_reg);
+
+		gpio_shadow_put(p.data_shadow, p.clr_reg, data & ~p.mask);
+	}
+	static inline uint32_t lev(const gpio_pin &p)
+	{
+		return gpio_pin_lev(p);
+	}
+};
 
-#define GPIO_SET(g)   *(int*)((char*)gpio+OFFSET+(g>>8)+SET) |= 1<<(int)(g&0xFF)
-#define GPIO_CLR(g)   *(int*)((char*)gpio+OFFSET+(g>>8)+SET) &= ~(1<<(int)(g&0xFF))
-#define GPIO_LEV(g)   (*(int*)((char*)gpio+OFFSET+(g>>8)+SET) >> (int)(g&0xFF)) & 0x1
+#define GPIO_HOST	gpio_a10
 
 /* default GPIO <-> PIC connections */
 #define DEFAULT_PIC_CLK    (int)((PB<<8)|15)   /* PGC - Output - PB15 */
@@ -33,16 +33,61 @@
 #define GPIO_OE_REG 0x4d
 #define GPIO_IN_REG 0x4e
 #define GPIO_OUT_REG 0x4f
+#define GPIO_CLEARDATAOUT_REG 0x64
+#define GPIO_SETDATAOUT_REG 0x65
 
-#define OFFSET(g) ((int)((bool)(g/32))*(GPIO1_BASE-GPIO0_BASE)+(int)((bool)(g/64))*(GPIO2_BASE-GPIO1_BASE)+(int)((bool)(g/96))*(GPIO3_BASE-GPIO2_BASE))/4
+/*
+ * GPIO backend for the TI AM335x. The output enable register of each bank
+ * is shadowed, data is written through the set/clear data out registers.
+ */
+struct gpio_am335x {
+	/* offset (in words) of the bank holding gpio g from GPIO0_BASE */
+	static inline int bank(int g)
+	{
+		return ((int)((bool)(g/32))*(GPIO1_BASE-GPIO0_BASE)+
+				(int)((bool)(g/64))*(GPIO2_BASE-GPIO1_BASE)+
+				(int)((bool)(g/96))*(GPIO3_BASE-GPIO2_BASE))/4;
+	}
+
+	static inline void resolve(gpio_pin &p)
+	{
+		volatile uint32_t *base = gpio+bank(p.num);
+
+		p.dir_reg = base+GPIO_OE_REG;	// OE: 0 is output, 1 is input
+		p.dir_shadow = p.num/32;
+		p.dir_mask = 0x01<<(p.num%32);
+		p.dir_in = p.dir_mask;
+		p.dir_out = 0;
+		p.set_reg = base+GPIO_SETDATAOUT_REG;
+		p.clr_reg = base+GPIO_CLEARDATAOUT_REG;
+		p.lev_reg = base+GPIO_IN_REG;
+		p.mask = 0x01<<(p.num%32);
+		p.shift = p.num%32;
+	}
 
-/* GPIO setup macros. Always use GPIO_IN(x) before using GPIO_OUT(x) */
-#define GPIO_OUT(g)   *(gpio+OFFSET(g)+GPIO_OE_REG) &= ~(0x01<<(g%32))
-#define GPIO_IN(g)    *(gpio+OFFSET(g)+GPIO_OE_REG) |= (0x01<<(g%32))
+	static inline void out(const gpio_pin &p)
+	{
+		gpio_pin_dir(p, p.dir_out);
+	}
+	static inline void in(const gpio_pin &p)
+	{
+		gpio_pin_dir(p, p.dir_in);
+	}
+	static inline void set(const gpio_pin &p)
+	{
+		*p.set_reg = p.mask;
+	}
+	static inline void clr(const gpio_pin &p)
+	{
+		*p.clr_reg = p.mask;
+	}
+	static inline uint32_t lev(const gpio_pin &p)
+	{
+		return gpio_pin_lev(p);
+	}
+};
 
-#define GPIO_SET(g)   *(gpio+OFFSET(g)+GPIO_OUT_REG) |= (0x01<<(g%32))
-#define GPIO_CLR(g)   *(gpio+OFFSET(g)+GPIO_OUT_REG) &= ~(0x01<<(g%32))
-#define GPIO_LEV(g)   (*(gpio+OFFSET(g)+GPIO_IN_REG) >> (g%32)) & 0x01
+#define GPIO_HOST	gpio_am335x
 
 /* default GPIO <-> PIC connections */
 #define DEFAULT_PIC_CLK    60   /* PGC  - Output - gpio1_28 */
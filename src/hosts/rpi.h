@@ -25,13 +25,62 @@
 #define BLOCK_SIZE         (256)
 #define PORTOFFSET         0
 
-/* GPIO setup macros. Always use GPIO_IN(x) before using GPIO_OUT(x) */
-#define GPIO_IN(g)    *(gpio+((g&0xFF)/10))   &= ~(7<<(((g&0xFF)%10)*3))
-#define GPIO_OUT(g)   *(gpio+((g&0xFF)/10))   |=  (1<<(((g&0xFF)%10)*3))
+/*
+ * GPIO backend for the BCM2835/6/7. Function select registers (words 0-5)
+ * are shadowed, set/clear/level have dedicated registers.
+ *
+ * Gang mode: the PGD pin descriptor carries the set/clear mask of all the
+ * targets' PGD lines, so a data bit reaches all of them in one store, and
+ * the other lines are chained through gang for direction changes. Every
+ * level read is also handed whole to gang_sample().
+ */
+struct gpio_bcm2835 {
+	static inline void resolve(gpio_pin &p)
+	{
+		int n = p.num&0xFF;
+
+		p.dir_reg = gpio+n/10;
+		p.dir_shadow = n/10;
+		p.dir_mask = 7<<((n%10)*3);
+		p.dir_in = 0;
+		p.dir_out = 1<<((n%10)*3);
+		p.set_reg = gpio+7;
+		p.clr_reg = gpio+10;
+		p.lev_reg = gpio+13;
+		p.mask = 1<<n;
+		p.shift = n;
+	}
+
+	static inline void in(const gpio_pin &p)
+	{
+		for (const gpio_pin *q = &p; q; q = q->gang)
+			gpio_pin_dir(*q, q->dir_in);
+	}
+	static inline void out(const gpio_pin &p)
+	{
+		for (const gpio_pin *q = &p; q; q = q->gang)
+			gpio_pin_dir(*q, q->dir_out);
+	}
+	static inline void set(const gpio_pin &p)
+	{
+		*p.set_reg = p.mask;
+	}
+	static inline void clr(const gpio_pin &p)
+	{
+		*p.clr_reg = p.mask;
+	}
+	static inline uint32_t lev(const gpio_pin &p)	/* reads pin level */
+	{
+		uint32_t levels = *p.lev_reg;
+
+		if (p.gang)
+			gang_sample(levels);
+		return (levels >> p.shift) & 0x1;
+	}
+};
 
-#define GPIO_SET(g)   *(gpio+7)  = 1<<(g&0xFF)
-#define GPIO_CLR(g)   *(gpio+10) = 1<<(g&0xFF)
-#define GPIO_LEV(g)   (*(gpio+13) >> (g&0xFF)) & 0x1 /* reads pin level */
+#define GPIO_HOST	gpio_bcm2835
+#define GPIO_GANG	/* gang programming supported */
 
 /* default GPIO <-> PIC connections */
 #define DEFAULT_PIC_CLK    23   /* PGC - Output */
@@ -0,0 +1,267 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Image cache: the image parsed from a hex file is saved in the private
+ * cache directory (cachedir.cpp), named after the hash, size and mtime of
+ * the file, so that programming the same file again only has to hash it
+ * and copy the cached words back. A cache file holds a header, the extents
+ * of the image (its occupancy index, from which the row indexes are
+ * derived) and then the words of each extent, as stored in the image.
+ *
+ * A hit is only taken if the header matches the hash of the whole source
+ * file, not just its size and mtime, and if the extents and words match
+ * the checksum stored with them. It refreshes the mtime of the cache file;
+ * after every store the least recently used files are removed until the
+ * cache fits in IMAGE_CACHE_MAX.
+ */
+#define IMAGE_CACHE_MAX		(64*1024*1024)
+#define IMAGE_CACHE_MAGIC	"PBIMAGE2"
+
+struct image_cache_header {
+	char		magic[8];
+	uint64_t	hash;			// of the source file
+	uint64_t	size;
+	int64_t		mtime;
+	uint32_t	program_memory_size;	// image the file was loaded into
+	uint32_t	offset;
+	uint32_t	filled_locations;
+	uint32_t	nextents;
+	uint64_t	data_hash;		// of the extents and words that follow
+};
+
+/* 64-bit hash of the file contents, eight bytes at a time */
+static uint64_t file_hash(const uint8_t *buf, size_t size)
+{
+	uint64_t h = 0x9E3779B97F4A7C15ULL ^ size, w;
+	size_t i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		memcpy(&w, buf + i, 8);
+		h ^= w * 0xC2B2AE3D27D4EB4FULL;
+		h = ((h << 31) | (h >> 33)) * 0x165667B19E3779F9ULL;
+	}
+	for ( ; i < size; i++)
+		h = (h ^ buf[i]) * 0x100000001B3ULL;
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	return h ^ (h >> 32);
+}
+
+static string cache_name(uint64_t hash, size_t size, time_t mtime)
+{
+	char name[128];
+
+	snprintf(name, sizeof(name), "img-%016llx-%llx-%llx.img",
+			 (unsigned long long) hash, (unsigned long long) size,
+			 (unsigned long long) mtime);
+	return name;
+}
+
+/* Fill the key fields of a header for the given source file */
+static void cache_key(image_cache_header &hdr, const void *buf, size_t size,
+		time_t mtime, memory *mem, uint32_t offset)
+{
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, IMAGE_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.hash = file_hash((const uint8_t *) buf, size);
+	hdr.size = size;
+	hdr.mtime = mtime;
+	hdr.program_memory_size = mem->program_memory_size;
+	hdr.offset = offset;
+}
+
+/*
+ * Load the image of the source file in buf (size bytes, modified at mtime)
+ * from the cache. Returns false on a miss, leaving the image untouched.
+ */
+bool image_cache_load(const void *buf, size_t size, time_t mtime,
+		memory *mem, uint32_t offset, unsigned int &filled_locations)
+{
+	image_cache_header key, hdr;
+	const memory_extent *ext;
+	const uint8_t *data;
+	string name;
+	struct stat st;
+	void *map;
+	uint64_t words = 0;
+	int fd;
+
+	cache_key(key, buf, size, mtime, mem, offset);
+	name = cache_name(key.hash, size, mtime);
+
+	fd = cache_open(name.c_str());
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(hdr)) {
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	memcpy(&hdr, map, sizeof(hdr));
+	key.filled_locations = hdr.filled_locations;
+	key.nextents = hdr.nextents;
+	key.data_hash = hdr.data_hash;
+	if (memcmp(&hdr, &key, sizeof(hdr)) != 0 ||
+			(st.st_size - sizeof(hdr)) / sizeof(memory_extent) < hdr.nextents) {
+		munmap(map, st.st_size);
+		close(fd);
+		return false;
+	}
+
+	/* check that all the extents are in range and in the file */
+	ext = (const memory_extent *) ((const uint8_t *) map + sizeof(hdr));
+	for (uint32_t i = 0; i < hdr.nextents; i++) {
+		if (ext[i].start >= ext[i].end ||
+				ext[i].end > mem->program_memory_size) {
+			munmap(map, st.st_size);
+			close(fd);
+			return false;
+		}
+		words += ext[i].end - ext[i].start;
+	}
+	if (sizeof(hdr) + hdr.nextents*sizeof(memory_extent) + 2*words !=
+			(uint64_t) st.st_size ||
+			file_hash((const uint8_t *) ext, st.st_size - sizeof(hdr)) !=
+			hdr.data_hash) {
+		munmap(map, st.st_size);
+		close(fd);
+		return false;
+	}
+
+	data = (const uint8_t *) (ext + hdr.nextents);
+	for (uint32_t i = 0; i < hdr.nextents; i++) {
+		mem->put_block(ext[i].start, data, ext[i].end - ext[i].start);
+		data += 2*(ext[i].end - ext[i].start);
+	}
+	munmap(map, st.st_size);
+
+	filled_locations = hdr.filled_locations;
+	futimens(fd, NULL);
+	close(fd);
+	if (flags.debug)
+		cerr << "Image cache hit: " << name << endl;
+	return true;
+}
+
+/* Remove the least recently used cache files beyond IMAGE_CACHE_MAX */
+static void cache_evict(void)
+{
+	vector<pair<time_t, string> > files;
+	struct dirent *entry;
+	struct stat st;
+	uint64_t total = 0;
+	char dirpath[256];
+	string path;
+	DIR *dir;
+
+	if (!cache_path(NULL, dirpath, sizeof(dirpath)))
+		return;
+	dir = opendir(dirpath);
+	if (dir == NULL)
+		return;
+	while ((entry = readdir(dir)) != NULL) {
+		path = string(dirpath) + "/" + entry->d_name;
+		if (strncmp(entry->d_name, "img-", 4) != 0 || path.size() < 4 ||
+				path.compare(path.size()-4, 4, ".img") != 0 ||
+				lstat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+		files.push_back(make_pair(st.st_mtime, path));
+		total += st.st_size;
+	}
+	closedir(dir);
+
+	sort(files.begin(), files.end());
+	for (size_t i = 0; i < files.size() && total > IMAGE_CACHE_MAX; i++) {
+		if (lstat(files[i].second.c_str(), &st) == 0 &&
+				unlink(files[i].second.c_str()) == 0)
+			total -= st.st_size;
+	}
+}
+
+/* Save the image just loaded from the source file in buf */
+void image_cache_store(const void *buf, size_t size, time_t mtime,
+		memory *mem, uint32_t offset, unsigned int filled_locations)
+{
+	const vector<memory_extent> &extents = mem->extents();
+	image_cache_header hdr;
+	vector<uint8_t> payload;
+	vector<uint16_t> words;
+	char tmp[256];
+	string name;
+	FILE *fp;
+	bool ok;
+
+	cache_key(hdr, buf, size, mtime, mem, offset);
+	hdr.filled_locations = filled_locations;
+	hdr.nextents = extents.size();
+	name = cache_name(hdr.hash, size, mtime);
+
+	for (size_t e = 0; e < extents.size(); e++)
+		for (uint32_t addr = extents[e].start; addr < extents[e].end; addr++)
+			words.push_back(mem->get(addr));
+	payload.resize(extents.size()*sizeof(memory_extent) + 2*words.size());
+	if (!payload.empty()) {
+		memcpy(payload.data(), extents.data(),
+				extents.size()*sizeof(memory_extent));
+		memcpy(payload.data() + extents.size()*sizeof(memory_extent),
+				words.data(), 2*words.size());
+	}
+	hdr.data_hash = file_hash(payload.data(), payload.size());
+
+	/* written to a new temporary file, so that a reader never sees it
+	 * partial */
+	fp = cache_create(name.c_str(), tmp, sizeof(tmp));
+	if (fp == NULL)
+		return;
+	ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		 fwrite(payload.data(), 1, payload.size(), fp) == payload.size();
+	if (!cache_commit(fp, tmp, name.c_str(), ok))
+		return;
+
+	if (flags.debug)
+		cerr << "Image cache: saved " << name << endl;
+	cache_evict();
+}
@@ -22,25 +22,87 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <iostream>
+#include <string>
 
 #include "common.h"
 
 using namespace std;
 
+/* size in bytes of the data records written by write_inhx() */
+unsigned int inhx_record_size = 16;
+/* what to do with words given by more than one input file */
+int inhx_overlap = INHX_OVERLAP_ERROR;
+
+#define INHX_BUFFER_SIZE    (64*1024)
+#define INHX_RECORD_MAX     (2*(1+2+1+255+1) + 2)  // chars, with ':' and '\n'
+
+/* value of each hex digit character, 0xFF for any other character */
+static uint8_t hex_digit[256];
+/* the two (lowercase) hex digits of each byte value */
+static char hex_pair[256][2];
+static bool hex_tables_ready = false;
+
+static void hex_tables_init(void)
+{
+    const char digits[] = "0123456789abcdef";
+
+    memset(hex_digit, 0xFF, sizeof(hex_digit));
+    for (int c = 0; c < 10; c++)
+        hex_digit['0' + c] = c;
+    for (int c = 0; c < 6; c++)
+        hex_digit['A' + c] = hex_digit['a' + c] = 10 + c;
+    for (int b = 0; b < 256; b++) {
+        hex_pair[b][0] = digits[b >> 4];
+        hex_pair[b][1] = digits[b & 0x0F];
+    }
+    hex_tables_ready = true;
+}
+
+/* Decode the byte written as two hex digits at p, before end */
+static inline bool hex_byte(const char *p, const char *end, uint8_t &byte)
+{
+    uint8_t hi, lo;
+
+    if (end - p < 2)
+        return false;
+    hi = hex_digit[(uint8_t)p[0]];
+    lo = hex_digit[(uint8_t)p[1]];
+    if ((hi | lo) & 0xF0)
+        return false;
+    byte = (hi << 4) | lo;
+    return true;
+}
+
+/* Store a data word, if inside the memory */
+static inline bool store_word(memory *mem, uint32_t extended_address,
+                              unsigned int i, uint32_t offset, uint16_t data)
+{
+    if (mem->program_memory_size > extended_address/2 + i - offset/2) {
+        mem->put(extended_address/2 + i - offset/2, data);
+        return true;
+    }
+    fprintf(stderr, " Input Hexfile contains out of range memory data (addr=0x%08X); ignored!\n", (extended_address/2 + i - offset/2)*2);
+    return false;
+}
+
 /*
- * Read a file in Intel HEX8M or HEX32 format and fill the memory structure
+ * Parse the Intel HEX8M or HEX32 text in buf and fill the memory structure.
+ * Every field is decoded in place through the hex_digit table and the
+ * checksum is accumulated in the same pass.
  * Returns the number of filled locations
- *
  */
-unsigned int read_inhx(char *infile, memory *mem, uint32_t offset)
+static unsigned int parse_inhx(const char *buf, size_t size, memory *mem,
+                               uint32_t offset)
 {
-    FILE *fp;
+    const char *line = buf, *end = buf + size, *eol, *ptr;
     int linenum;
-    char line[256], *ptr;
     size_t linelen;
-    int nread;
 
     unsigned int filled_locations=0;
 
@@ -50,166 +112,140 @@ unsigned int read_inhx(char *infile, memory *mem, uint32_t offset)
     uint16_t address;
     uint32_t extended_address;
     uint8_t  record_type;
-    uint16_t data, tmp;
+    uint16_t data;
+    uint8_t  hi, lo;
     uint8_t  checksum_calculated;
     uint8_t  checksum_read;
 
-    fp = fopen(infile, "r");
-    if (fp == NULL) {
-        cerr << "Error: cannot open source file " << infile << endl;
-        return 0;
-    }
-
-    if(flags.debug) cerr << "Reading hex file..." << endl;
-
     linenum = 0;
     while (1) {
-        ptr = fgets(line, 256, fp);
-
-        if (ptr != NULL) {
-            linenum++;
-            linelen = strlen(line);
-            if (flags.debug) {
-                fprintf(stderr, "  line %d (%zd bytes): '", linenum, linelen);
-                for (i = 0; i < linelen; i++) {
-                    if (line[i] == '\n')
-                        cerr << "\\n";
-                    else if (line[i] == '\r')
-                        cerr << "\\r";
-                    else
-                        fprintf(stderr, "%c", line[i]);
-                }
-                cerr << "'\n";
-            }
+        if (line >= end) {
+            cerr << "Error: unexpected EOF." << endl;
+            return 0;
+        }
 
-            if (line[0] != ':') {
-                cerr << "Error: invalid start code."  << endl;
-                return 0;
+        eol = (const char *) memchr(line, '\n', end - line);
+        linelen = eol ? eol - line + 1 : end - line;
+        eol = line + linelen;
+        linenum++;
+        if (flags.debug) {
+            fprintf(stderr, "  line %d (%zd bytes): '", linenum, linelen);
+            for (i = 0; i < linelen; i++) {
+                if (line[i] == '\n')
+                    cerr << "\\n";
+                else if (line[i] == '\r')
+                    cerr << "\\r";
+                else
+                    fprintf(stderr, "%c", line[i]);
             }
+            cerr << "'\n";
+        }
 
-            nread = sscanf(&line[1], "%2hhx", &byte_count);
-            if (nread != 1) {
-                cerr << "Error: cannot read byte count." << endl;
-                return 0;
-            }
-            if (flags.debug) fprintf(stderr, "  byte_count  = 0x%02X\n", byte_count);
+        if (line[0] != ':') {
+            cerr << "Error: invalid start code."  << endl;
+            return 0;
+        }
 
-            nread = sscanf(&line[3], "%4hx", &address);
-            if (nread != 1) {
-                cerr << "Error: cannot read address." << endl;
-                return 0;
-            }
+        if (!hex_byte(&line[1], eol, byte_count)) {
+            cerr << "Error: cannot read byte count." << endl;
+            return 0;
+        }
+        if (flags.debug) fprintf(stderr, "  byte_count  = 0x%02X\n", byte_count);
 
-            nread = sscanf(&line[7], "%2hhx", &record_type);
-            if (nread != 1) {
-                cerr << "Error: cannot read record type." << endl;
-                return 0;
-            }
+        if (!hex_byte(&line[3], eol, hi) || !hex_byte(&line[5], eol, lo)) {
+            cerr << "Error: cannot read address." << endl;
+            return 0;
+        }
+        address = (hi << 8) | lo;
+
+        if (!hex_byte(&line[7], eol, record_type)) {
+            cerr << "Error: cannot read record type." << endl;
+            return 0;
+        }
 
-            if (flags.debug && record_type != 0x04) fprintf(stderr, "  address     = 0x%04X\n", address);
+        if (flags.debug && record_type != 0x04) fprintf(stderr, "  address     = 0x%04X\n", address);
 
-            if (flags.debug)
-                fprintf(stderr, "  record_type = 0x%02X (%s)\n",
-                        record_type, record_type == 0 ? "data" :
-                            (record_type == 1 ? "EOF" :
-                                (record_type == 0x04 ? "Extended Linear Address" : "Unknown")));
+        if (flags.debug)
+            fprintf(stderr, "  record_type = 0x%02X (%s)\n",
+                    record_type, record_type == 0 ? "data" :
+                        (record_type == 1 ? "EOF" :
+                            (record_type == 0x04 ? "Extended Linear Address" : "Unknown")));
 
-            if (record_type != 0 && record_type != 1 && record_type != 0x04) {
+        if (record_type != 0 && record_type != 1 && record_type != 0x04) {
             cerr << "Error: unknown record type." << endl;
-                return 0;
-            }
+            return 0;
+        }
 
-            checksum_calculated  = byte_count;
-            checksum_calculated += (address >> 8) & 0xFF;
-            checksum_calculated += address & 0xFF;
-            checksum_calculated += record_type;
-
-            if(record_type == 0x04){
-                nread = sscanf(&line[9], "%4hx", &base_address);
-                if (flags.debug) fprintf(stderr, "  NEW BASE ADDRESS     = 0x%04X\n", base_address);
-                checksum_calculated += (base_address >> 8) & 0xFF;
-                checksum_calculated += base_address & 0xFF;
-                i = 1;
-            } else {
-                for (i = 0; i < byte_count/2; i++) {
-                    nread = sscanf(&line[9+4*i], "%4hx", &data);
-                    if (nread != 1) {
-                        cerr << "Error: cannot read data." << endl;
-                        return 0;
-                    }
-                    tmp = data;
-                    data = (data >> 8) | (tmp << 8);
-                    if (flags.debug) fprintf(stderr, "  data        = 0x%04X", data);
-                    checksum_calculated += (data >> 8) & 0xFF;
-                    checksum_calculated += data & 0xFF;
-
-                    extended_address = ( ((uint32_t)base_address << 16) | address);
-                    if (flags.debug)
-                        fprintf(stderr, " @0x%08X\n", extended_address/2+i);
-
-                    if (mem->program_memory_size > extended_address/2 + i - offset/2) {
-                        mem->location[extended_address/2 + i - offset/2] = data;
-                        mem->filled[extended_address/2 + i - offset/2] = 1;
-                        filled_locations++;
-                    } else {
-                        fprintf(stderr, " Input Hexfile contains out of range memory data (addr=0x%08X); ignored!\n", (extended_address/2 + i - offset/2)*2);
-                    }
+        checksum_calculated  = byte_count;
+        checksum_calculated += hi;
+        checksum_calculated += lo;
+        checksum_calculated += record_type;
+
+        ptr = &line[9];
+        extended_address = ( ((uint32_t)base_address << 16) | address);
+
+        if(record_type == 0x04){
+            if (hex_byte(ptr, eol, hi) && hex_byte(ptr+2, eol, lo))
+                base_address = (hi << 8) | lo;
+            if (flags.debug) fprintf(stderr, "  NEW BASE ADDRESS     = 0x%04X\n", base_address);
+            checksum_calculated += (base_address >> 8) & 0xFF;
+            checksum_calculated += base_address & 0xFF;
+            ptr += 4;
+        } else {
+            for (i = 0; i < byte_count/2; i++, ptr += 4) {
+                if (!hex_byte(ptr, eol, lo) || !hex_byte(ptr+2, eol, hi)) {
+                    cerr << "Error: cannot read data." << endl;
+                    return 0;
                 }
-              if (byte_count % 2) {
-                nread = sscanf(&line[9+4*i], "%2hx", &data);
-                    if (nread != 1) {
-                        cerr << "Error: cannot read data." << endl;
-                        return 0;
-                    }
-                    if (flags.debug) fprintf(stderr, "  data        = 0x%04X", data);
-                    checksum_calculated += data & 0xFF;
-
-                    extended_address = ( ((uint32_t)base_address << 16) | address);
-                    if (flags.debug)
-                        fprintf(stderr, " @0x%08X\n", extended_address/2+i);
-
-                    if (mem->program_memory_size > extended_address/2 + i - offset/2) {
-                        mem->location[extended_address/2 + i - offset/2] = 0xff00 | data;
-                        mem->filled[extended_address/2 + i - offset/2] = 1;
-                        filled_locations++;
-                    } else {
-                        fprintf(stderr, " Input Hexfile contains out of range memory data (addr=0x%08X); ignored!\n", (extended_address/2 + i - offset/2)*2);
-                    }
-              }
-            }
+                data = (hi << 8) | lo;
+                checksum_calculated += lo + hi;
 
-            checksum_calculated = (checksum_calculated ^ 0xFF) + 1;
+                if (flags.debug)
+                    fprintf(stderr, "  data        = 0x%04X @0x%08X\n", data, extended_address/2+i);
 
-            if (byte_count % 2)
-                nread = sscanf(&line[9+4*i+2], "%2hhx", &checksum_read);
-            else
-                nread = sscanf(&line[9+4*i], "%2hhx", &checksum_read);
-            if (nread != 1) {
-                cerr << "Error: cannot read checksum." << endl;
-                return 0;
+                if (store_word(mem, extended_address, i, offset, data))
+                    filled_locations++;
             }
-            if (flags.debug) fprintf(stderr, "  checksum    = 0x%02X\n", checksum_read);
+            if (byte_count % 2) {
+                if (!hex_byte(ptr, eol, lo)) {
+                    cerr << "Error: cannot read data." << endl;
+                    return 0;
+                }
+                checksum_calculated += lo;
 
-            if (checksum_calculated != checksum_read) {
-                cerr << "Error: checksum does not match. ";
+                if (flags.debug)
+                    fprintf(stderr, "  data        = 0x%04X @0x%08X\n", lo, extended_address/2+i);
 
-                if(flags.debug)
-                    fprintf(stderr, "Calculated = 0x%02X, Read = 0x%02X\n", checksum_calculated, checksum_read);
-                return 0;
+                if (store_word(mem, extended_address, i, offset, 0xff00 | lo))
+                    filled_locations++;
+                ptr += 2;
             }
+        }
 
-            if (flags.debug)
-                cerr << "\n";
+        checksum_calculated = (checksum_calculated ^ 0xFF) + 1;
 
-            if (record_type == 0x01)
-                break;
-        } else {
-            cerr << "Error: unexpected EOF." << endl;
+        if (!hex_byte(ptr, eol, checksum_read)) {
+            cerr << "Error: cannot read checksum." << endl;
             return 0;
         }
-    }
+        if (flags.debug) fprintf(stderr, "  checksum    = 0x%02X\n", checksum_read);
+
+        if (checksum_calculated != checksum_read) {
+            cerr << "Error: checksum does not match. ";
+
+            if(flags.debug)
+                fprintf(stderr, "Calculated = 0x%02X, Read = 0x%02X\n", checksum_calculated, checksum_read);
+            return 0;
+        }
+
+        if (flags.debug)
+            cerr << "\n";
 
-    fclose(fp);
+        if (record_type == 0x01)
+            break;
+
+        line = eol;
+    }
 
     if(flags.debug)
         cerr << "DONE! " << filled_locations << " memory locations read." << endl;
@@ -217,81 +253,396 @@ unsigned int read_inhx(char *infile, memory *mem, uint32_t offset)
     return filled_locations;
 }
 
-/* Write the filled cells in given memory struct
- * to an Intel HEX8M or HEX32 file */
-void write_inhx(memory *mem, char *outfile, uint32_t offset)
+/*
+ * Read a file in Intel HEX8M or HEX32 format and fill the memory structure;
+ * ELF files are recognized by their magic and loaded by read_elf(), and
+ * hex files already parsed are taken from the image cache.
+ * Returns the number of filled locations
+ *
+ */
+static unsigned int read_file(const char *infile, memory *mem, uint32_t offset)
 {
-    FILE *fp;
-    uint32_t base, j, k, start, stop;
-    uint8_t  byte_count;
-    uint32_t address;
-    uint16_t base_address = 0x0000;
-    uint8_t  record_type;
-    uint16_t data, tmp;
-    uint8_t  checksum;
+    int fd;
+    struct stat st;
+    void *map;
+    unsigned int filled_locations;
+
+    fd = open(infile, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error: cannot open source file " << infile << endl;
+        return 0;
+    }
+
+    if(flags.debug) cerr << "Reading hex file..." << endl;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        cerr << "Error: unexpected EOF." << endl;
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        cerr << "Error: cannot open source file " << infile << endl;
+        return 0;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    if (is_elf(map, st.st_size)) {
+        filled_locations = read_elf(map, st.st_size, mem, offset);
+    } else if (flags.no_image_cache ||
+               !image_cache_load(map, st.st_size, st.st_mtime, mem, offset,
+                                 filled_locations)) {
+        if (!hex_tables_ready)
+            hex_tables_init();
+        filled_locations = parse_inhx((const char *) map, st.st_size, mem, offset);
+        if (!flags.no_image_cache && filled_locations)
+            image_cache_store(map, st.st_size, st.st_mtime, mem, offset,
+                              filled_locations);
+    }
+
+    munmap(map, st.st_size);
+    return filled_locations;
+}
+
+/*
+ * Copy the words of part into mem, applying the overlap policy to the
+ * words mem already holds with a different value. Returns false on an
+ * overlap refused by the policy.
+ */
+static bool merge_image(memory *part, memory *mem, const char *name,
+                        uint32_t offset)
+{
+    const vector<memory_extent> &extents = part -> extents();
+    unsigned int overlaps = 0;
+    uint16_t data;
+
+    for (size_t e = 0; e < extents.size(); e++) {
+        for (uint32_t k = extents[e].start; k < extents[e].end; k++) {
+            data = part -> get(k);
+            if (mem -> filled(k) && mem -> get(k) != data) {
+                if (inhx_overlap == INHX_OVERLAP_ERROR) {
+                    fprintf(stderr, "Error: %s overlaps the previous files "
+                            "at 0x%08X!\n", name, k*2 + offset);
+                    return false;
+                }
+                overlaps++;
+                if (inhx_overlap == INHX_OVERLAP_FIRST)
+                    continue;
+            }
+            mem -> put(k, data);
+        }
+    }
+
+    if (overlaps)
+        fprintf(stderr, " %s overlaps the previous files at %u locations; "
+                "%s files kept\n", name, overlaps,
+                inhx_overlap == INHX_OVERLAP_FIRST ? "previous" : "its");
+    return true;
+}
 
-    fp = fopen(outfile?outfile:"ofile.hex", "w");
+/*
+ * Read a comma separated list of files into one image, so that they are
+ * programmed in a single pass. The files are loaded in order, each into an
+ * image of its own, and then merged; words given with the same value by
+ * several files are not overlaps.
+ * Returns the number of filled locations
+ */
+unsigned int read_inhx(char *infile, memory *mem, uint32_t offset)
+{
+    string list(infile), name;
+    size_t pos = 0, comma;
+    unsigned int filled_locations = 0;
+
+    if (list.find(',') == string::npos)
+        return read_file(infile, mem, offset);
+
+    while (pos <= list.size()) {
+        comma = list.find(',', pos);
+        if (comma == string::npos)
+            comma = list.size();
+        name = list.substr(pos, comma - pos);
+        pos = comma + 1;
+        if (name.empty())
+            continue;
+
+        memory part;
+        part.init(mem -> program_memory_size);
+        if (!read_file(name.c_str(), &part, offset))
+            return 0;
+        if (!merge_image(&part, mem, name.c_str(), offset))
+            return 0;
+    }
+
+    const vector<memory_extent> &extents = mem -> extents();
+    for (size_t e = 0; e < extents.size(); e++)
+        filled_locations += extents[e].end - extents[e].start;
+    return filled_locations;
+}
+
+/* Append a byte as two hex digits, adding it to the checksum */
+static inline char *put_byte(char *ptr, uint8_t byte, uint8_t &checksum)
+{
+    ptr[0] = hex_pair[byte][0];
+    ptr[1] = hex_pair[byte][1];
+    checksum += byte;
+    return ptr + 2;
+}
+
+/* Append the checksum and the end of line of a record */
+static inline char *put_checksum(char *ptr, uint8_t checksum)
+{
+    checksum = (checksum ^ 0xFF) + 1;
+    ptr[0] = hex_pair[checksum][0];
+    ptr[1] = hex_pair[checksum][1];
+    ptr[2] = '\n';
+    return ptr + 3;
+}
+
+/*
+ * Intel HEX8M or HEX32 output. Words are put() in address order and
+ * gathered in records of inhx_record_size bytes at most, ending where the
+ * words stop being consecutive or at a 64 KiB boundary, which a record
+ * cannot cross. The records are formatted into a buffer, written out in
+ * INHX_BUFFER_SIZE blocks.
+ */
+class hex_writer{
+
+    public:
+        bool open(const char *outfile, uint32_t memory_size, uint32_t offset);
+        bool close(void);
+
+        void put(uint32_t addr, uint16_t data) {
+            if (count != 0 && (count == words || addr != start + count ||
+                               ((addr*2 + offset) & 0xFFFF) == 0))
+                record();
+            if (count == 0)
+                start = addr;
+            pending[count++] = data;
+        };
+
+    private:
+        void record(void);
+
+        void flush(void);
+
+        const char  *name;
+        FILE        *fp;
+        bool        error;              // a write failed
+        char        *buf, *ptr;
+        uint32_t    offset;
+        bool        extended;           // write extended linear addresses
+        uint16_t    base_address;
+        uint32_t    words;              // per record
+        uint32_t    start, count;       // record being gathered
+        uint16_t    pending[256/2];
+};
+
+bool hex_writer::open(const char *outfile, uint32_t memory_size,
+                      uint32_t offset)
+{
+    name = outfile?outfile:"ofile.hex";
+    fp = fopen(name, "w");
     if (fp == NULL) {
-        cerr << "Error: cannot open destination file " << outfile << endl;
-        return;
+        cerr << "Error: cannot open destination file " << name << endl;
+        return false;
+    }
+    error = false;
+
+    buf = (char *) malloc(INHX_BUFFER_SIZE);
+    if (buf == NULL) {
+        cerr << "Error: cannot allocate the output buffer" << endl;
+        fclose(fp);
+        return false;
     }
 
     if(flags.debug)
         cerr << "Writing hex file...";
 
-    /* Write the program memory bytes */
+    if (!hex_tables_ready)
+        hex_tables_init();
+
+    ptr = buf;
+    this->offset = offset;
+    extended = memory_size >= 0x10000;
+    base_address = 0x0000;
+    words = inhx_record_size / 2;
+    if (words == 0)
+        words = 1;
+    count = 0;
+    return true;
+}
 
-    for (base = 0; base < mem -> program_memory_size; ){
+/* Format the record gathered so far */
+void hex_writer::record(void)
+{
+    uint32_t address = start*2+offset;
+    uint8_t  checksum;
+
+    if (ptr - buf > INHX_BUFFER_SIZE - 2*INHX_RECORD_MAX)
+        flush();
+
+    if(extended && (address >> 16) != base_address){  //extended linear address
+        base_address = (address >> 16);
+        checksum = 0;
+        *ptr++ = ':';
+        ptr = put_byte(ptr, 0x02, checksum);
+        ptr = put_byte(ptr, 0x00, checksum);
+        ptr = put_byte(ptr, 0x00, checksum);
+        ptr = put_byte(ptr, 0x04, checksum);
+        ptr = put_byte(ptr, base_address >> 8, checksum);
+        ptr = put_byte(ptr, base_address & 0xFF, checksum);
+        ptr = put_checksum(ptr, checksum);
+    }
 
-        for (j = 0 ; j < (mem -> program_memory_size - base); j++)
-            if (mem -> filled[base+j]) break;
+    checksum = 0;
+    *ptr++ = ':';
+    ptr = put_byte(ptr, count*2, checksum);
+    ptr = put_byte(ptr, (address >> 8) & 0xFF, checksum);
+    ptr = put_byte(ptr, address & 0xFF, checksum);
+    ptr = put_byte(ptr, 0x00, checksum);    // record type: data
 
-        start = j;
+    for (uint32_t k = 0; k < count; k++) {
+        ptr = put_byte(ptr, pending[k] & 0xFF, checksum);
+        ptr = put_byte(ptr, pending[k] >> 8, checksum);
+    }
 
-        for ( ; j < (mem -> program_memory_size - base); j++)
-            if (!mem -> filled[base+j] || (j-start == 8) ) break;
+    ptr = put_checksum(ptr, checksum);
+    count = 0;
+}
 
-        stop = j;
+/* Write out the formatted records; after an error, only drop them */
+void hex_writer::flush(void)
+{
+    if (!error && fwrite(buf, 1, ptr - buf, fp) != (size_t)(ptr - buf)) {
+        cerr << "Error: cannot write destination file " << name << endl;
+        error = true;
+    }
+    ptr = buf;
+}
 
-        byte_count  = (stop - start)*2;
+bool hex_writer::close(void)
+{
+    if (count != 0)
+        record();
 
-        if (byte_count > 0) {
-            address = (base + start)*2+offset;
-            record_type = 0x00;
+    memcpy(ptr, ":00000001FF\n", 12);
+    ptr += 12;
+    flush();
 
-            if(mem -> program_memory_size >= 0x10000 && (address >> 16) != base_address){  //extended linear address
-                base_address = (address >> 16);
-                fprintf(fp, ":02000004%04x", base_address);
-                checksum = 0x06 + ((base_address>>8) & 0xFF) + (base_address & 0xFF);
-                checksum = (checksum ^ 0xFF) + 1;
-                fprintf(fp, "%02x\n", checksum);
-            }
+    free(buf);
+    if (fclose(fp) != 0 && !error) {
+        cerr << "Error: cannot write destination file " << name << endl;
+        error = true;
+    }
+    if(flags.debug && !error)
+        cerr << "DONE!" << endl;
+    return !error;
+}
 
-            fprintf(fp, ":%02x%04x%02x", byte_count, (address & 0x0000FFFF), record_type);
+/* Write the filled cells in given memory image
+ * to an Intel HEX8M or HEX32 file; only the extents of the image are
+ * visited. */
+void write_inhx(memory *mem, char *outfile, uint32_t offset)
+{
+    const vector<memory_extent> &extents = mem -> extents();
+    hex_writer writer;
 
-            checksum  = byte_count;
-            checksum += ((address & 0x0000FFFF) >> 8) & 0xFF;
-            checksum += (address & 0x0000FFFF) & 0xFF;
-            checksum += record_type;
+    if (!writer.open(outfile, mem -> program_memory_size, offset))
+        return;
 
-            for (k = start; k < stop; k++) {
-                data = mem -> location[base+k];
-                tmp = data;
-                data = (data >> 8) | (tmp << 8);
-                fprintf(fp, "%04x", data);
-                checksum += (data >> 8) & 0xFF;
-                checksum += data & 0xFF;
-            }
+    for (size_t e = 0; e < extents.size(); e++)
+        for (uint32_t k = extents[e].start; k < extents[e].end; k++)
+            writer.put(k, mem -> get(k));
 
-            checksum = (checksum ^ 0xFF) + 1;
-            fprintf(fp, "%02x\n", checksum);
+    writer.close();
+}
 
+hex_sink::hex_sink(char *outfile, uint32_t memory_size, uint32_t offset) :
+        memory_size(memory_size), writer(0), current(0), failed(false),
+        done(false)
+{
+    hex_writer *w = new hex_writer;
+
+    if (!w->open(outfile, memory_size, offset)) {
+        delete w;
+        failed = true;
+        return;
+    }
+    writer = w;
+    current = new chunk;
+    current->count = 0;
+    thread = std::thread(&hex_sink::consume, this);
+}
+
+/* Hand the current chunk to the writer thread, and take a spare one;
+ * wait for the writer if the queue is full */
+void hex_sink::push(void)
+{
+    chunk *next = 0;
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        room.wait(guard, [this] {return queue.size() < HEX_SINK_QUEUE_CHUNKS;});
+        queue.push_back(current);
+        if (!spare.empty()) {
+            next = spare.back();
+            spare.pop_back();
         }
-        base += stop;
     }
+    ready.notify_one();
 
-    fprintf(fp, ":00000001FF\n");
-    fclose(fp);
-    if(flags.debug)
-        cerr << "DONE!" << endl;
+    if (next == 0)
+        next = new chunk;
+    next->count = 0;
+    current = next;
+}
+
+/* Writer thread: format the queued chunks until close() */
+void hex_sink::consume(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    chunk *c;
+
+    realtime_worker();
+    while (1) {
+        ready.wait(guard, [this] {return !queue.empty() || done;});
+        if (queue.empty())
+            break;
+        c = queue.front();
+        queue.pop_front();
+
+        guard.unlock();
+        for (uint32_t i = 0; i < c->count; i++)
+            writer->put(c->addr + i, c->words[i]);
+        guard.lock();
+
+        spare.push_back(c);
+        room.notify_one();
+    }
+}
+
+bool hex_sink::close(void)
+{
+    if (writer == 0)
+        return !failed;
+
+    if (current->count != 0)
+        push();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+    }
+    ready.notify_one();
+    thread.join();
+
+    failed = !writer->close();
+    delete writer;
+    writer = 0;
+
+    delete current;
+    for (size_t i = 0; i < spare.size(); i++)
+        delete spare[i];
+    spare.clear();
+    return !failed;
 }
@@ -0,0 +1,102 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INHX_H_
+#define INHX_H_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Streaming hex output for read(): the drivers put() each word as soon as
+ * it has been read from the target, and a writer thread formats and writes
+ * the records while the reading goes on. Consecutive words are queued in
+ * chunks of HEX_SINK_CHUNK_WORDS, which are recycled once written, so that
+ * neither the image nor the queue grow with the address space.
+ *
+ * Words are expected in increasing address order (as the devices are
+ * read); the records are then the same that write_inhx() would write for
+ * an image holding the same words.
+ *
+ * At most HEX_SINK_QUEUE_CHUNKS chunks wait for the writer: put() then
+ * blocks until one is written, so a slow output cannot grow the queue
+ * without bound. A file that cannot be opened or written is reported by
+ * close().
+ */
+#define HEX_SINK_CHUNK_WORDS	256
+#define HEX_SINK_QUEUE_CHUNKS	64
+
+class hex_writer;
+
+class hex_sink{
+
+	public:
+		hex_sink(char *outfile, uint32_t memory_size, uint32_t offset = 0);
+		~hex_sink() {close();};
+		hex_sink(const hex_sink &) = delete;
+		hex_sink &operator=(const hex_sink &) = delete;
+
+		/* Queue a word; out of range is ignored, as by memory::put() */
+		void put(uint32_t addr, uint16_t data) {
+			if (writer == 0 || addr >= memory_size)
+				return;
+			if (current->count != 0 && (current->count == HEX_SINK_CHUNK_WORDS
+					|| addr != current->addr + current->count))
+				push();
+			if (current->count == 0)
+				current->addr = addr;
+			current->words[current->count++] = data;
+		};
+
+		/* Write what is still queued and close the file; false if the
+		 * file could not be opened or written */
+		bool close(void);
+
+	private:
+		struct chunk{
+			uint32_t	addr;
+			uint32_t	count;
+			uint16_t	words[HEX_SINK_CHUNK_WORDS];
+		};
+
+		void push(void);
+		void consume(void);
+
+		uint32_t				memory_size;
+		hex_writer				*writer;	// 0 if the file could not be opened
+		chunk					*current;	// being filled by put()
+		bool					failed;		// open or write error
+
+		std::mutex				lock;		// protects the fields below
+		std::condition_variable	ready;		// a chunk queued, or done
+		std::condition_variable	room;		// a chunk written
+		std::deque<chunk *>		queue;		// full chunks, to be written
+		std::vector<chunk *>	spare;		// written chunks, to be reused
+		bool					done;
+
+		std::thread				thread;
+};
+
+#endif /* INHX_H_ */
@@ -0,0 +1,235 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Link training: the drivers use the worst-case bit timings of the
+ * programming specs, which many setups can beat (and long cables may not
+ * meet). The device ID is read LINK_READS times in a row at each of a
+ * series of bit timing scales; the fastest scale at which all the reads
+ * match is found, and one step slower than that is used as margin. If
+ * even the nominal timing fails, slower scales are tried.
+ *
+ * The scale only applies to the PGC high/low and PGD setup/hold times
+ * (see delay_bit_ns()), which are what the ID reads exercise; the other
+ * delays, e.g. the ones with a maximum or the erase and programming
+ * times, are never scaled.
+ *
+ * The reads are compared with a reference device ID, read once at nominal
+ * timing before anything else. The result is cached in LINK_CACHE (in the
+ * private cache directory) per family and pin set, and checked again
+ * (LINK_READS reads) before being reused; a cached scale that is not one
+ * of link_scales is ignored.
+ * Program mode is restarted (and the PE, if any, set up again) after
+ * every failed attempt.
+ */
+#define LINK_CACHE	"link.cache"
+#define LINK_READS	8
+
+/*
+ * bit timing scales (percent of nominal), from slowest to fastest; there
+ * is no 0, which would leave only the time taken by the GPIO accesses
+ */
+static const unsigned int link_scales[] = {800, 400, 200, 100, 70, 50, 35,
+										   25, 18, 12, 8, 5};
+#define LINK_NOMINAL	3
+
+struct link_reference {
+	bool valid;
+	uint32_t device_id;
+	uint16_t device_rev;
+};
+
+/* Free the memory allocated by read_device_id() */
+static void release_memory(Pic *pic)
+{
+	pic->mem.clear();
+}
+
+/* Restart program mode at nominal timing, after a garbled exchange */
+static void resync(Pic *pic)
+{
+	delay_set_scale(100);
+	pic->exit_program_mode();
+	pic->enter_program_mode();
+	pic->setup_pe();
+}
+
+/* Read the device ID LINK_READS times at the given scale */
+static bool link_pass(Pic *pic, unsigned int scale, link_reference &ref)
+{
+	bool found;
+
+	delay_set_scale(scale);
+	for (int i = 0; i < LINK_READS; i++) {
+		found = pic->read_device_id();
+		release_memory(pic);
+		if (found && !ref.valid) {
+			ref.device_id = pic->device_id;
+			ref.device_rev = pic->device_rev;
+			ref.valid = true;
+		}
+		if (!found || pic->device_id != ref.device_id ||
+				pic->device_rev != ref.device_rev) {
+			resync(pic);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Read the reference device ID at nominal timing */
+static bool link_reference_read(Pic *pic, link_reference &ref)
+{
+	delay_set_scale(link_scales[LINK_NOMINAL]);
+	ref.valid = pic->read_device_id();
+	ref.device_id = pic->device_id;
+	ref.device_rev = pic->device_rev;
+	release_memory(pic);
+	if (!ref.valid)
+		resync(pic);
+	return ref.valid;
+}
+
+static string link_key(const char *family)
+{
+	char key[128];
+
+	snprintf(key, sizeof(key), "%s:%s:%d,%d,%d", family,
+			 gpiochip ? gpiochip : "mem",
+			 pic_clk.num, pic_data.num, pic_mclr.num);
+	return key;
+}
+
+static bool known_scale(unsigned int scale)
+{
+	for (size_t i = 0; i < sizeof(link_scales)/sizeof(link_scales[0]); i++)
+		if (link_scales[i] == scale)
+			return true;
+	return false;
+}
+
+static bool load_scale(const string &key, unsigned int &scale)
+{
+	FILE *fp;
+	char k[128];
+	unsigned int s;
+	bool found = false;
+
+	fp = cache_fopen(LINK_CACHE);
+	if (fp == NULL)
+		return false;
+	while (fscanf(fp, "%127s %u", k, &s) == 2)
+		if (key == k && known_scale(s)) {
+			scale = s;
+			found = true;
+		}
+	fclose(fp);
+	return found;
+}
+
+static void save_scale(const string &key, unsigned int scale)
+{
+	FILE *fp;
+	char k[128], tmp[256];
+	unsigned int s;
+	vector<pair<string, unsigned int> > entries;
+
+	fp = cache_fopen(LINK_CACHE);
+	if (fp != NULL) {
+		while (fscanf(fp, "%127s %u", k, &s) == 2)
+			if (key != k && known_scale(s))
+				entries.push_back(make_pair(string(k), s));
+		fclose(fp);
+	}
+	entries.push_back(make_pair(key, scale));
+
+	fp = cache_create(LINK_CACHE, tmp, sizeof(tmp));
+	if (fp == NULL)
+		return;
+	for (size_t i = 0; i < entries.size(); i++)
+		fprintf(fp, "%s %u\n", entries[i].first.c_str(), entries[i].second);
+	cache_commit(fp, tmp, LINK_CACHE, true);
+}
+
+/* Find and apply the fastest reliable bit timing for this target */
+void link_train(Pic *pic, const char *family)
+{
+	const int nscales = sizeof(link_scales)/sizeof(link_scales[0]);
+	link_reference ref = {false, 0, 0};
+	string key = link_key(family);
+	unsigned int scale = 100;
+	int i, fastest = -1, chosen;
+
+	if (link_reference_read(pic, ref) && load_scale(key, scale) &&
+			link_pass(pic, scale, ref)) {
+		fprintf(stdout, "Link training: bit timing at %u%% of nominal "
+				"(cached)\n", scale);
+		return;
+	}
+
+	if (link_pass(pic, link_scales[LINK_NOMINAL], ref)) {
+		/* speed up until the reads fail */
+		fastest = LINK_NOMINAL;
+		for (i = LINK_NOMINAL+1; i < nscales; i++) {
+			if (!link_pass(pic, link_scales[i], ref))
+				break;
+			fastest = i;
+		}
+		chosen = (fastest > LINK_NOMINAL) ? fastest-1 : LINK_NOMINAL;
+	}
+	else {
+		/* slow down until the reads succeed */
+		ref.valid = false;
+		for (i = LINK_NOMINAL-1; i >= 0; i--) {
+			if (link_pass(pic, link_scales[i], ref)) {
+				fastest = i;
+				break;
+			}
+			ref.valid = false;
+		}
+		chosen = (fastest > 0) ? fastest-1 : fastest;
+	}
+
+	if (fastest < 0) {
+		delay_set_scale(100);
+		fprintf(stdout, "Link training: no reliable bit timing found, "
+				"using nominal\n");
+		return;
+	}
+
+	delay_set_scale(link_scales[chosen]);
+	save_scale(key, link_scales[chosen]);
+	fprintf(stdout, "Link training: bit timing at %u%% of nominal "
+			"(fastest passing %u%%)\n", link_scales[chosen],
+			link_scales[fastest]);
+}
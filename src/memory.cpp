@@ -0,0 +1,344 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "common.h"
+
+/*
+ * The page directory has one entry per MEMORY_PAGE_WORDS words of the
+ * address space (24576 entries for the 0x03000000 words of a PIC32), while
+ * only the pages actually written are allocated: a firmware image takes
+ * about its own size, whatever the address space of the family.
+ */
+void memory::init(uint32_t size)
+{
+	clear();
+	npages = (size + MEMORY_PAGE_WORDS - 1) >> MEMORY_PAGE_SHIFT;
+	pages = (page **) calloc(npages, sizeof(page *));
+	if (pages == 0) {
+		npages = 0;
+		return;
+	}
+	program_memory_size = size;
+}
+
+void memory::clear(void)
+{
+	for (uint32_t i = 0; i < npages; i++)
+		free(pages[i]);
+	free(pages);
+	pages = 0;
+	npages = 0;
+	program_memory_size = 0;	// every access is out of range until init()
+	invalidate();
+}
+
+/* Drop the extents and row indexes, after a change of the image */
+void memory::invalidate(void)
+{
+	extents_valid = false;
+	extent_list.clear();
+	row_index.clear();
+}
+
+/* Page holding addr, allocated if needed; 0 if out of range */
+memory::page *memory::page_for_write(uint32_t addr)
+{
+	page *p;
+
+	if (addr >= program_memory_size)
+		return 0;
+	if (extents_valid)
+		invalidate();
+	p = pages[addr >> MEMORY_PAGE_SHIFT];
+	if (p == 0) {
+		p = (page *) calloc(1, sizeof(page));
+		if (p == 0)
+			return 0;
+		pages[addr >> MEMORY_PAGE_SHIFT] = p;
+	}
+	return p;
+}
+
+/* Store a word; out of range is ignored */
+void memory::put(uint32_t addr, uint16_t data)
+{
+	page *p = page_for_write(addr);
+
+	if (p == 0)
+		return;
+	addr &= MEMORY_PAGE_WORDS-1;
+	p->location[addr] = data;
+	p->filled[addr / MEMORY_FILL_BITS] |= 1UL << (addr % MEMORY_FILL_BITS);
+}
+
+/* Set the bits [from, to) of a page bitmap */
+static void set_bits(unsigned long *bits, uint32_t from, uint32_t to)
+{
+	uint32_t first = from / MEMORY_FILL_BITS, last = (to - 1) / MEMORY_FILL_BITS;
+	unsigned long w;
+
+	for (uint32_t i = first; i <= last; i++) {
+		w = ~0UL;
+		if (i == first)
+			w &= ~0UL << (from % MEMORY_FILL_BITS);
+		if (i == last && to % MEMORY_FILL_BITS)
+			w &= ~0UL >> (MEMORY_FILL_BITS - to % MEMORY_FILL_BITS);
+		bits[i] |= w;
+	}
+}
+
+/*
+ * Store count words given as little-endian byte pairs, copied as they are
+ * a page at a time. Words out of range are dropped; returns the number of
+ * words stored.
+ */
+uint32_t memory::put_block(uint32_t addr, const uint8_t *data, uint32_t count)
+{
+	uint32_t i, n, stored = 0;
+	page *p;
+
+	if (addr >= program_memory_size)
+		return 0;
+	if (count > program_memory_size - addr)
+		count = program_memory_size - addr;
+	while (count) {
+		p = page_for_write(addr);
+		if (p == 0)
+			break;
+		i = addr & (MEMORY_PAGE_WORDS-1);
+		n = (count < MEMORY_PAGE_WORDS - i) ? count : MEMORY_PAGE_WORDS - i;
+		memcpy(&p->location[i], data, 2*n);
+		set_bits(p->filled, i, i + n);
+		addr += n;
+		data += 2*n;
+		count -= n;
+		stored += n;
+	}
+	return stored;
+}
+
+/* First set bit of a page bitmap in [from, to), to if none */
+static uint32_t first_filled(const unsigned long *bits, uint32_t from,
+		uint32_t to)
+{
+	uint32_t i = from / MEMORY_FILL_BITS, pos;
+	unsigned long w = bits[i] & (~0UL << (from % MEMORY_FILL_BITS));
+
+	while (1) {
+		if (w) {
+			pos = i * MEMORY_FILL_BITS + __builtin_ctzl(w);
+			return (pos < to) ? pos : to;
+		}
+		if (++i * MEMORY_FILL_BITS >= to)
+			return to;
+		w = bits[i];
+	}
+}
+
+/* First clear bit of a page bitmap in [from, MEMORY_PAGE_WORDS) */
+static uint32_t first_empty(const unsigned long *bits, uint32_t from)
+{
+	uint32_t i = from / MEMORY_FILL_BITS;
+	unsigned long w = ~bits[i] & (~0UL << (from % MEMORY_FILL_BITS));
+
+	while (1) {
+		if (w)
+			return i * MEMORY_FILL_BITS + __builtin_ctzl(w);
+		if (++i == MEMORY_PAGE_WORDS / MEMORY_FILL_BITS)
+			return MEMORY_PAGE_WORDS;
+		w = ~bits[i];
+	}
+}
+
+/* Number of set bits of a page bitmap in [from, to) */
+static uint32_t count_bits(const unsigned long *bits, uint32_t from,
+		uint32_t to)
+{
+	uint32_t first = from / MEMORY_FILL_BITS, last = (to - 1) / MEMORY_FILL_BITS;
+	uint32_t n = 0;
+	unsigned long w;
+
+	for (uint32_t i = first; i <= last; i++) {
+		w = bits[i];
+		if (i == first)
+			w &= ~0UL << (from % MEMORY_FILL_BITS);
+		if (i == last && to % MEMORY_FILL_BITS)
+			w &= ~0UL >> (MEMORY_FILL_BITS - to % MEMORY_FILL_BITS);
+		n += __builtin_popcountl(w);
+	}
+	return n;
+}
+
+bool memory::any_filled(uint32_t addr, uint32_t count) const
+{
+	uint32_t end = addr + count, from, to;
+
+	if (end > program_memory_size)
+		end = program_memory_size;
+	while (addr < end) {
+		const page *p = pages[addr >> MEMORY_PAGE_SHIFT];
+
+		from = addr & (MEMORY_PAGE_WORDS-1);
+		to = (end - addr < MEMORY_PAGE_WORDS - from) ?
+				from + (end - addr) : MEMORY_PAGE_WORDS;
+		if (p && first_filled(p->filled, from, to) < to)
+			return true;
+		addr += to - from;
+	}
+	return false;
+}
+
+uint32_t memory::count_filled(uint32_t addr, uint32_t count) const
+{
+	uint32_t end = addr + count, from, to, n = 0;
+
+	if (end > program_memory_size)
+		end = program_memory_size;
+	while (addr < end) {
+		const page *p = pages[addr >> MEMORY_PAGE_SHIFT];
+
+		from = addr & (MEMORY_PAGE_WORDS-1);
+		to = (end - addr < MEMORY_PAGE_WORDS - from) ?
+				from + (end - addr) : MEMORY_PAGE_WORDS;
+		if (p)
+			n += count_bits(p->filled, from, to);
+		addr += to - from;
+	}
+	return n;
+}
+
+/*
+ * Move addr to the first present page at or after the page containing it
+ * (addr is left unchanged if its page is present). Returns false if there
+ * is none.
+ */
+bool memory::next_page(uint32_t &addr) const
+{
+	uint32_t i;
+
+	for (i = addr >> MEMORY_PAGE_SHIFT; i < npages; i++)
+		if (pages[i]) {
+			if (i != addr >> MEMORY_PAGE_SHIFT)
+				addr = i << MEMORY_PAGE_SHIFT;
+			return true;
+		}
+	return false;
+}
+
+/* First filled word at or after addr, program_memory_size if none */
+uint32_t memory::next_filled(uint32_t addr) const
+{
+	uint32_t pos;
+
+	while (addr < program_memory_size && next_page(addr)) {
+		const page *p = pages[addr >> MEMORY_PAGE_SHIFT];
+
+		pos = first_filled(p->filled, addr & (MEMORY_PAGE_WORDS-1),
+				MEMORY_PAGE_WORDS);
+		if (pos < MEMORY_PAGE_WORDS)
+			return (addr & ~(MEMORY_PAGE_WORDS-1)) + pos;
+		addr = (addr | (MEMORY_PAGE_WORDS-1)) + 1;
+	}
+	return program_memory_size;
+}
+
+uint32_t memory::page_count(void) const
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < npages; i++)
+		if (pages[i])
+			n++;
+	return n;
+}
+
+/* First empty word at or after addr, program_memory_size if none */
+uint32_t memory::next_empty(uint32_t addr) const
+{
+	uint32_t pos;
+
+	while (addr < program_memory_size) {
+		const page *p = pages[addr >> MEMORY_PAGE_SHIFT];
+
+		if (p == 0)
+			return addr;
+		pos = first_empty(p->filled, addr & (MEMORY_PAGE_WORDS-1));
+		if (pos < MEMORY_PAGE_WORDS)
+			return (addr & ~(MEMORY_PAGE_WORDS-1)) + pos;
+		addr = (addr | (MEMORY_PAGE_WORDS-1)) + 1;
+	}
+	return program_memory_size;
+}
+
+const std::vector<memory_extent> &memory::extents(void)
+{
+	memory_extent e;
+
+	if (extents_valid)
+		return extent_list;
+
+	for (e.start = next_filled(0); e.start < program_memory_size;
+			e.start = next_filled(e.end)) {
+		e.end = next_empty(e.start);
+		extent_list.push_back(e);
+	}
+	extents_valid = true;
+	return extent_list;
+}
+
+/* Start addresses of the rows holding filled words */
+const std::vector<uint32_t> &memory::rows(uint32_t row_words)
+{
+	const std::vector<memory_extent> &ext = extents();
+	std::map<uint32_t, std::vector<uint32_t> >::iterator it;
+	uint32_t row;
+
+	it = row_index.find(row_words);
+	if (it != row_index.end())
+		return it->second;
+
+	std::vector<uint32_t> &index = row_index[row_words];
+	for (size_t i = 0; i < ext.size(); i++) {
+		row = ext[i].start - ext[i].start % row_words;
+		if (!index.empty() && index.back() == row)
+			row += row_words;
+		for ( ; row < ext[i].end; row += row_words)
+			index.push_back(row);
+	}
+	return index;
+}
+
+/* First row holding filled words starting at or after addr, else
+ * program_memory_size */
+uint32_t memory::next_row(uint32_t addr, uint32_t row_words)
+{
+	const std::vector<uint32_t> &index = rows(row_words);
+	std::vector<uint32_t>::const_iterator it;
+
+	it = std::lower_bound(index.begin(), index.end(), addr);
+	return (it != index.end()) ? *it : program_memory_size;
+}
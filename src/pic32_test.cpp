@@ -0,0 +1,690 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2016 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "devices/pic32.h"
+
+/*
+ * Tests of the PIC32 driver against a simulated PIC32MX1 (built with
+ * gpio_sim.h). The target decodes the 2-wire ICSP bits (4-phase when the
+ * host releases PGD for the TDO clock, 2-phase otherwise) into a JTAG TAP
+ * with the MTAP and ETAP registers used by the driver, runs the serial
+ * execution instructions that store the PE_Loader, the PE_Loader itself,
+ * and a programming executive taking its commands through FASTDATA. The
+ * PE is busy for ROW_BUSY clocks after programming each row, as a real one
+ * is: it does not set prAcc meanwhile, and a fast data word shifted in then
+ * is lost, which leaves the PE and the driver waiting for each other (a
+ * session longer than SESSION clocks fails the test). It answers a PROGRAM
+ * command once, after the last row, with FAIL if any of its rows failed.
+ * Run with `make test`.
+ */
+
+struct flags_struct flags;
+
+gpio_pin pic_clk(20), pic_data(21), pic_mclr(22);
+
+#define DEVICE_ID	0x04D07053	// PIC32MX130F064B, 0xF000 words
+#define FLASH_BASE	0x1D000000
+#define FLASH_SIZE	0x1E000
+#define BOOT_BASE	0x1FC00000
+#define BOOT_SIZE	0xC00
+#define ROW_SIZE	128
+#define PAGE_SIZE	0x400
+#define ROW_BUSY	400			// PGC clocks to program a row
+#define ERASE_BUSY	2000		// PGC clocks to erase
+#define SESSION		5000000		// PGC clocks before a session is taken as hung
+
+void delay_us(unsigned int howLong)
+{
+}
+
+void delay_ns(unsigned int howLong)
+{
+}
+
+void delay_bit_us(unsigned int howLong)
+{
+}
+
+void delay_bit_ns(unsigned int howLong)
+{
+}
+
+void realtime_worker(void)
+{
+}
+
+enum tap_state {TLR, RTI, SEL_DR, CAP_DR, SHIFT_DR, EXIT1_DR, PAUSE_DR,
+	EXIT2_DR, UPD_DR, SEL_IR, CAP_IR, SHIFT_IR, EXIT1_IR, PAUSE_IR, EXIT2_IR,
+	UPD_IR};
+
+/* next TAP state, by current state and TMS */
+static const tap_state tap_next[16][2] = {
+	{RTI, TLR}, {RTI, SEL_DR}, {CAP_DR, SEL_IR}, {SHIFT_DR, EXIT1_DR},
+	{SHIFT_DR, EXIT1_DR}, {PAUSE_DR, UPD_DR}, {PAUSE_DR, EXIT2_DR},
+	{SHIFT_DR, UPD_DR}, {RTI, SEL_DR}, {CAP_IR, TLR}, {SHIFT_IR, EXIT1_IR},
+	{SHIFT_IR, EXIT1_IR}, {PAUSE_IR, UPD_IR}, {PAUSE_IR, EXIT2_IR},
+	{SHIFT_IR, UPD_IR}, {RTI, SEL_DR}
+};
+
+static struct {
+	/* ICSP and TAP */
+	bool clk, mclr, data, driving, tdo, tdi;
+	int phase;					// clock of the current bit, see target_falling()
+	uint64_t now;				// PGC clocks since the start
+	uint64_t deadline;			// end of the session, see session()
+	tap_state state;
+	bool mtap;					// MTAP selected, else ETAP
+	uint8_t ir;
+	uint64_t dr;
+	int dr_len, shifted, shifted_2phase;
+	bool captured_pracc;
+
+	/* CPU: serial execution, then PE_Loader, then PE */
+	enum {EXEC, LOADER, PE} mode;
+	uint32_t reg[32], data_reg, jump;
+	bool delay_slot;
+	std::map<uint32_t, uint32_t> ram;
+	uint32_t load_addr, load_count;
+	bool load_header;
+	std::vector<uint32_t> responses;
+	uint64_t busy_until;
+	std::vector<uint32_t> params;	// command word and its parameters
+
+	/* flash, as bytes */
+	std::vector<uint8_t> flash, boot;
+
+	/* target behaviour, and what the driver did */
+	bool corrupt_2phase;		// flip bit 0 of words sent 2-phase
+	uint32_t fail_row;			// row of a PROGRAM that fails, once
+	bool program_failed;
+	bool loader_ok, pe_ok;
+	unsigned long words_2phase, words_lost, page_erases;
+	unsigned long bursts, row_programs;
+} sim;
+
+static uint8_t *flash_at(uint32_t addr)
+{
+	if (addr >= FLASH_BASE && addr < FLASH_BASE + FLASH_SIZE)
+		return &sim.flash[addr - FLASH_BASE];
+	if (addr >= BOOT_BASE && addr < BOOT_BASE + BOOT_SIZE)
+		return &sim.boot[addr - BOOT_BASE];
+	return 0;
+}
+
+static void respond(uint32_t word)
+{
+	sim.responses.push_back(word);
+}
+
+/* CRC-CCITT, MSb first, seed 0xFFFF, bit by bit */
+static uint16_t flash_crc(uint32_t addr, uint32_t length)
+{
+	uint16_t crc = 0xFFFF;
+	uint8_t *p;
+
+	for (uint32_t i = 0; i < length; i++) {
+		p = flash_at(addr + i);
+		crc ^= (p ? *p : 0xFF) << 8;
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static void program_row(uint32_t addr, const uint32_t *words)
+{
+	uint8_t *p;
+
+	for (int i = 0; i < ROW_SIZE; i++) {
+		p = flash_at(addr + i);
+		if (p)
+			*p &= words[i/4] >> (8*(i%4));
+	}
+	sim.busy_until = sim.now + ROW_BUSY;
+}
+
+/* A word for the PE: a command, or one of its parameters or data words */
+static void pe_word(uint32_t word)
+{
+	std::vector<uint32_t> &p = sim.params;
+	uint32_t op, words, addr;
+	uint8_t *b;
+
+	p.push_back(word);
+	op = p[0] >> 16;
+	switch (op) {
+		case 0x0:		// ROW_PROGRAM: address, one row of words
+			if (p.size() < 2 + ROW_SIZE/4)
+				return;
+			program_row(p[1], &p[2]);
+			sim.row_programs++;
+			respond(0x00000000);
+			break;
+		case 0x2:		// PROGRAM: address, length, rows of words
+			if (p.size() < 3)
+				return;
+			words = p.size() - 3;
+			if (words == 0 || words % (ROW_SIZE/4) != 0)
+				return;
+			addr = p[1] + (words - ROW_SIZE/4)*4;
+			if (addr == sim.fail_row) {
+				sim.fail_row = 0;
+				sim.program_failed = true;
+			}
+			else
+				program_row(addr, &p[3 + words - ROW_SIZE/4]);
+			if (words*4 < p[2])
+				return;
+			sim.bursts++;
+			respond(sim.program_failed ? 0x00020002 : 0x00020000);
+			sim.program_failed = false;
+			break;
+		case 0x4:		// CHIP_ERASE
+			sim.flash.assign(FLASH_SIZE, 0xFF);
+			sim.boot.assign(BOOT_SIZE, 0xFF);
+			sim.busy_until = sim.now + ERASE_BUSY;
+			respond(0x00040000);
+			break;
+		case 0x5:		// PAGE_ERASE: address
+			if (p.size() < 2)
+				return;
+			for (uint32_t i = 0; i < (p[0] & 0xFFFF)*PAGE_SIZE; i++)
+				if ((b = flash_at(p[1] + i)))
+					*b = 0xFF;
+			sim.busy_until = sim.now + ERASE_BUSY;
+			sim.page_erases++;
+			respond(0x00050000);
+			break;
+		case 0x7:		// EXEC_VERSION
+			respond(0x00070301);
+			break;
+		case 0x8:		// GET_CRC: address, length
+			if (p.size() < 3)
+				return;
+			respond(0x00080000);
+			respond(flash_crc(p[1], p[2]));
+			break;
+		default:
+			respond(p[0] | 0x3);	// NACK
+			break;
+	}
+	p.clear();
+}
+
+/* A word for the PE_Loader: (address, count) pairs followed by count
+ * words, until the count is 0xDEAD0000 */
+static void loader_word(uint32_t word)
+{
+	if (sim.load_count) {
+		sim.ram[sim.load_addr] = word;
+		sim.load_addr += 4;
+		sim.load_count--;
+		return;
+	}
+	if (!sim.load_header) {
+		sim.load_addr = word;
+		sim.load_header = true;
+		return;
+	}
+	sim.load_header = false;
+	if (word != 0xDEAD0000) {
+		sim.load_count = word;
+		return;
+	}
+	sim.pe_ok = true;
+	for (size_t i = 0; i < pic32_pemx1.size(); i++)
+		if (sim.ram[0x900 + 4*i] != pic32_pemx1[i])
+			sim.pe_ok = false;
+	sim.mode = sim.PE;
+}
+
+/* The MIPS instructions sent by XferInstruction() to store the PE_Loader */
+static void execute(uint32_t instr)
+{
+	uint32_t *r = sim.reg;
+	uint32_t rs = (instr >> 21) & 0x1F, rt = (instr >> 16) & 0x1F;
+	uint32_t imm = instr & 0xFFFF;
+	int16_t offset = imm;
+
+	if (sim.delay_slot && sim.jump == 0xA0000800) {
+		sim.loader_ok = true;
+		for (size_t i = 0; i < pe_loader.size(); i++)
+			if (sim.ram[0xA0000800 + 4*i] != pe_loader[i])
+				sim.loader_ok = false;
+		sim.mode = sim.LOADER;
+	}
+	sim.delay_slot = false;
+
+	switch (instr >> 26) {
+		case 0x00:		// jr
+			if ((instr & 0x3F) == 0x08) {
+				sim.jump = r[rs];
+				sim.delay_slot = true;
+			}
+			break;
+		case 0x09: r[rt] = r[rs] + offset; break;				// addiu
+		case 0x0D: r[rt] = r[rs] | imm; break;					// ori
+		case 0x0F: r[rt] = imm << 16; break;					// lui
+		case 0x23: r[rt] = sim.ram[r[rs] + offset]; break;		// lw
+		case 0x2B: sim.ram[r[rs] + offset] = r[rt]; break;		// sw
+	}
+	r[0] = 0;
+}
+
+static bool pe_ready(void)
+{
+	return sim.now >= sim.busy_until && sim.responses.empty();
+}
+
+static void capture_dr(void)
+{
+	sim.dr_len = 1;
+	sim.dr = 0;
+	sim.shifted = sim.shifted_2phase = 0;
+	if (sim.mtap) {
+		if (sim.ir == 0x01) {			// IDCODE
+			sim.dr_len = 32;
+			sim.dr = DEVICE_ID;
+		}
+		else if (sim.ir == 0x07) {		// COMMAND: CPS and CFGRDY set
+			sim.dr_len = 8;
+			sim.dr = 0x88;
+		}
+		return;
+	}
+	switch (sim.ir) {
+		case 0x09:						// DATA
+			sim.dr_len = 32;
+			sim.dr = sim.mode == sim.PE && !sim.responses.empty() ?
+					sim.responses[0] : sim.data_reg;
+			break;
+		case 0x0A:						// CONTROL
+			sim.dr_len = 32;
+			sim.captured_pracc = sim.mode == sim.EXEC ||
+					(sim.mode == sim.PE && sim.now >= sim.busy_until &&
+					 !sim.responses.empty());
+			sim.dr = (uint64_t)sim.captured_pracc << 18;
+			break;
+		case 0x0E:						// FASTDATA: prAcc, then data
+			sim.dr_len = 33;
+			sim.captured_pracc = sim.mode == sim.LOADER ||
+					(sim.mode == sim.PE && pe_ready());
+			sim.dr = sim.captured_pracc;
+			break;
+	}
+}
+
+static void update_dr(void)
+{
+	uint32_t word;
+
+	if (sim.mtap)
+		return;
+	switch (sim.ir) {
+		case 0x09:
+			sim.data_reg = sim.dr;
+			break;
+		case 0x0A:
+			if (!sim.captured_pracc || (sim.dr >> 18) & 0x1)
+				break;
+			if (sim.mode == sim.EXEC)
+				execute(sim.data_reg);
+			else if (sim.mode == sim.PE)
+				sim.responses.erase(sim.responses.begin());
+			break;
+		case 0x0E:
+			if (sim.shifted != 33)
+				break;
+			if (!sim.captured_pracc) {
+				sim.words_lost++;
+				break;
+			}
+			word = sim.dr >> 1;
+			if (sim.shifted_2phase) {
+				sim.words_2phase++;
+				if (sim.corrupt_2phase)
+					word ^= 0x1;
+			}
+			if (sim.mode == sim.LOADER)
+				loader_word(word);
+			else if (sim.mode == sim.PE)
+				pe_word(word);
+			break;
+	}
+}
+
+/* One TDI/TMS bit: shift, move the TAP, and present the next TDO */
+static void tap_bit(bool tdi, bool tms)
+{
+	if (sim.state == SHIFT_DR) {
+		sim.dr = (sim.dr >> 1) | ((uint64_t)tdi << (sim.dr_len - 1));
+		sim.shifted++;
+	}
+	else if (sim.state == SHIFT_IR)
+		sim.ir = (sim.ir >> 1) | (tdi << 4);
+
+	sim.state = tap_next[sim.state][tms];
+	switch (sim.state) {
+		case TLR:
+			sim.ir = 0x01;
+			break;
+		case CAP_DR:
+			capture_dr();
+			break;
+		case UPD_DR:
+			update_dr();
+			break;
+		case UPD_IR:
+			if (sim.ir == 0x04)			// SW_MTAP
+				sim.mtap = true;
+			else if (sim.ir == 0x05)	// SW_ETAP
+				sim.mtap = false;
+			break;
+		default:
+			break;
+	}
+	sim.tdo = (sim.state == SHIFT_IR) ? sim.ir & 0x1 : sim.dr & 0x1;
+}
+
+static void target_reset(void)
+{
+	sim.phase = 0;
+	sim.state = TLR;
+	sim.mtap = true;
+	sim.ir = 0x01;
+	sim.mode = sim.EXEC;
+	sim.delay_slot = false;
+	sim.ram.clear();
+	sim.load_count = 0;
+	sim.load_header = false;
+	sim.responses.clear();
+	sim.params.clear();
+	sim.busy_until = 0;
+}
+
+/*
+ * TDI is sampled on the first falling edge of a bit and TMS on the second;
+ * if the host then releases PGD, two more clocks follow (4-phase), the TDO
+ * being read on the rising edge of the last one; if not, the next falling
+ * edge is the TDI of the next bit (2-phase).
+ */
+static void target_falling(void)
+{
+	switch (sim.phase) {
+		case 0:
+			sim.tdi = sim.data;
+			sim.phase = 1;
+			break;
+		case 1:
+			tap_bit(sim.tdi, sim.data);
+			sim.phase = 2;
+			break;
+		case 2:
+			if (!sim.driving) {
+				sim.phase = 3;
+				break;
+			}
+			if (sim.state == SHIFT_DR || sim.state == EXIT1_DR)
+				sim.shifted_2phase++;
+			sim.tdi = sim.data;
+			sim.phase = 1;
+			break;
+		case 3:
+			sim.phase = 0;
+			break;
+	}
+}
+
+void gpio_sim::resolve(gpio_pin &p)
+{
+}
+
+void gpio_sim::in(const gpio_pin &p)
+{
+	if (&p == &pic_data)
+		sim.driving = false;
+}
+
+void gpio_sim::out(const gpio_pin &p)
+{
+	if (&p == &pic_data)
+		sim.driving = true;
+}
+
+static char image[] = "/tmp/pic32_test_XXXXXX";
+
+void gpio_sim::set(const gpio_pin &p)
+{
+	if (&p == &pic_clk && !sim.clk) {
+		sim.clk = true;
+		if (++sim.now < sim.deadline)
+			return;
+		printf("FAIL: session still running after %d clocks\nFAILED\n",
+				SESSION);
+		unlink(image);
+		exit(1);
+	}
+	else if (&p == &pic_mclr && !sim.mclr) {
+		sim.mclr = true;
+		target_reset();
+	}
+	else if (&p == &pic_data)
+		sim.data = true;
+}
+
+void gpio_sim::clr(const gpio_pin &p)
+{
+	if (&p == &pic_clk && sim.clk) {
+		sim.clk = false;
+		if (sim.mclr)
+			target_falling();
+	}
+	else if (&p == &pic_mclr)
+		sim.mclr = false;
+	else if (&p == &pic_data)
+		sim.data = false;
+}
+
+uint32_t gpio_sim::lev(const gpio_pin &p)
+{
+	return (&p == &pic_data && !sim.driving) ? sim.tdo : 0;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failures++;
+}
+
+/* The image: [start, end) ranges of bytes, each word a function of its
+ * address */
+static const uint32_t image_ranges[][2] = {
+	{0x1D000000, 0x1D000200},	// four rows: one PROGRAM
+	{0x1D000400, 0x1D000428},	// part of a row: ROW_PROGRAM
+	{0x1D000802, 0x1D000812},	// high half only, ..., low half only
+	{0x1D001F80, 0x1D002100},	// three rows across a page boundary
+	{0x1FC00100, 0x1FC00140},	// boot flash
+};
+
+static uint32_t image_word(uint32_t addr)
+{
+	return (addr * 0x9E3779B1) ^ 0x5A5AA5A5;
+}
+
+static void write_image(const char *name)
+{
+	FILE *fp = fopen(name, "w");
+	uint32_t addr, word, n;
+	uint16_t upper = 0;
+	uint8_t sum;
+
+	/* one record per word, or per part of a word at the range ends */
+	for (size_t r = 0; r < sizeof(image_ranges)/sizeof(image_ranges[0]); r++)
+		for (addr = image_ranges[r][0]; addr < image_ranges[r][1]; addr += n) {
+			if (addr >> 16 != upper) {
+				upper = addr >> 16;
+				sum = 2 + 4 + (upper >> 8) + (upper & 0xFF);
+				fprintf(fp, ":02000004%04X%02X\n", upper, (uint8_t)-sum);
+			}
+			n = std::min(4 - addr%4, image_ranges[r][1] - addr);
+			word = image_word(addr & ~3) >> 8*(addr%4);
+			sum = n + ((addr >> 8) & 0xFF) + (addr & 0xFF);
+			fprintf(fp, ":%02X%04X00", n, addr & 0xFFFF);
+			for (uint32_t i = 0; i < n; i++) {
+				fprintf(fp, "%02X", (word >> 8*i) & 0xFF);
+				sum += word >> 8*i;
+			}
+			fprintf(fp, "%02X\n", (uint8_t)-sum);
+		}
+	fprintf(fp, ":00000001FF\n");
+	fclose(fp);
+}
+
+/* The flash holds the image, and is erased elsewhere */
+static bool flash_is_image(void)
+{
+	std::vector<uint8_t> flash(FLASH_SIZE, 0xFF), boot(BOOT_SIZE, 0xFF);
+	uint32_t addr;
+
+	for (size_t r = 0; r < sizeof(image_ranges)/sizeof(image_ranges[0]); r++)
+		for (addr = image_ranges[r][0]; addr < image_ranges[r][1]; addr++) {
+			if (addr >= BOOT_BASE)
+				boot[addr - BOOT_BASE] = image_word(addr & ~3) >> 8*(addr%4);
+			else
+				flash[addr - FLASH_BASE] = image_word(addr & ~3) >> 8*(addr%4);
+		}
+	return flash == sim.flash && boot == sim.boot;
+}
+
+/* pic.write(), what it prints on stderr saved in log */
+static void write_logged(pic32 &pic, std::string &log)
+{
+	FILE *fp = tmpfile();
+	int saved;
+	char line[256];
+
+	fflush(stderr);
+	saved = dup(2);
+	dup2(fileno(fp), 2);
+	pic.write(image);
+	fflush(stderr);
+	dup2(saved, 2);
+	close(saved);
+
+	rewind(fp);
+	while (fgets(line, sizeof(line), fp))
+		log += line;
+	fclose(fp);
+}
+
+/* A new programming session, as started by picberry; the flash is left as
+ * it is */
+static bool session(pic32 &pic)
+{
+	sim.deadline = sim.now + SESSION;
+	pic.exit_program_mode();
+	pic.enter_program_mode();
+	sim.loader_ok = sim.pe_ok = false;
+	sim.words_2phase = sim.words_lost = sim.page_erases = 0;
+	sim.bursts = sim.row_programs = 0;
+	return pic.setup_pe() && pic.read_device_id();
+}
+
+int main(void)
+{
+	pic32 pic(SF_PIC32MX1);
+	std::string log;
+
+	close(mkstemp(image));
+	write_image(image);
+	flags.no_image_cache = 1;
+	sim.flash.assign(FLASH_SIZE, 0x00);
+	sim.boot.assign(BOOT_SIZE, 0x00);
+
+	check(session(pic), "device ID read");
+
+	pic.write(image);
+	check(sim.loader_ok && sim.pe_ok, "PE_Loader and PE downloaded intact");
+	check(flash_is_image() && sim.page_erases == 0,
+			"write: flash holds the image, verified at the first try");
+	check(sim.flash[0x800] == 0xFF && sim.flash[0x801] == 0xFF &&
+			sim.flash[0x812] == 0xFF && sim.flash[0x813] == 0xFF,
+			"write: unfilled halves of half-filled words left erased");
+	check(sim.words_2phase > 0 && sim.words_lost == 0,
+			"write: 2-phase words sent, none while the PE was busy");
+	check(sim.bursts == 2 && sim.row_programs == 3,
+			"write: runs of rows sent with PROGRAM, single rows with ROW_PROGRAM");
+
+	flags.pe_4phase = 1;
+	session(pic);
+	pic.write(image);
+	check(sim.pe_ok && flash_is_image() && sim.words_2phase == 0 &&
+			sim.words_lost == 0, "--pe-4phase: no 2-phase words, flash verified");
+	flags.pe_4phase = 0;
+
+	sim.corrupt_2phase = true;
+	session(pic);
+	pic.write(image);
+	check(flash_is_image() && sim.page_erases > 0,
+			"2-phase words garbled: failing pages programmed again");
+	sim.words_2phase = 0;
+	pic.write(image);
+	check(flash_is_image() && sim.words_2phase == 0,
+			"2-phase words garbled: 4-phase for the rest of the session");
+	sim.corrupt_2phase = false;
+
+	session(pic);
+	sim.fail_row = 0x1D002000;
+	write_logged(pic, log);
+	check(log.find("rows 1d001f80-1d002080") != std::string::npos,
+			"PROGRAM failing: the rows of the burst reported");
+	check(flash_is_image() && sim.page_erases == 1,
+			"PROGRAM failing: the failing page programmed again");
+
+	session(pic);
+	flags.verify_region = 0x600;
+	sim.flash[0] = 0x00;
+	pic.write(image);
+	check(sim.bursts == 0 && sim.row_programs == 0 && sim.flash[0] == 0x00,
+			"--verify-region not a multiple of the page: write refused");
+	flags.verify_region = PAGE_SIZE;
+	pic.write(image);
+	check(flash_is_image(), "--verify-region of one page: flash verified");
+	flags.verify_region = 0x10000;
+
+	unlink(image);
+
+	printf("%s\n", failures ? "FAILED" : "All tests passed");
+	return failures ? 1 : 0;
+}
@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -56,12 +57,13 @@
 int                 mem_fd;
 void                *gpio_map;
 volatile uint32_t   *gpio;
+char                *gpiochip = 0;  // if set, use this GPIO character device
 
 struct flags_struct flags;
 
-int pic_clk  = DEFAULT_PIC_CLK;
-int pic_data = DEFAULT_PIC_DATA;
-int pic_mclr = DEFAULT_PIC_MCLR;
+gpio_pin pic_clk  = DEFAULT_PIC_CLK;
+gpio_pin pic_data = DEFAULT_PIC_DATA;
+gpio_pin pic_mclr = DEFAULT_PIC_MCLR;
 char pic_clk_port=0, pic_data_port=0, pic_mclr_port=0;
 
 #define FXN_NULL        0b000000000
@@ -75,19 +77,13 @@ char pic_clk_port=0, pic_data_port=0, pic_mclr_port=0;
 #define FXN_DUMP_UID	0b010000000
 #define FXN_WRITE_UID	0b100000000
 
-/* Hardware delay function by Gordon's Projects - WiringPi */
-void delay_us (unsigned int howLong)
-{
-	struct timeval tNow, tLong, tEnd;
-
-	gettimeofday (&tNow, 0);
-	tLong.tv_sec  = howLong / 1000000;
-	tLong.tv_usec = howLong % 1000000;
-	timeradd (&tNow, &tLong, &tEnd);
-
-	while (timercmp (&tNow, &tEnd, <))
-		gettimeofday (&tNow, 0);
-}
+/* long-only options with an argument */
+#define OPT_SLEEP_THRESHOLD	1000
+#define OPT_GPIOCHIP		1001
+#define OPT_REALTIME		1002
+#define OPT_HEX_RECORD_SIZE	1003
+#define OPT_OVERLAP			1004
+#define OPT_VERIFY_REGION	1005
 
 int main(int argc, char *argv[])
 {
@@ -99,10 +95,15 @@ int main(int argc, char *argv[])
     char *pins = 0;
     char *family = 0;
     uint32_t count = 0, start = 0;
+    unsigned long region;
+    char *end;
     int option_index = 0;
     int server_port = 15000;
     uint8_t retval = 0;
+    int status = 0;         // exit status
 	uint64_t userid = 0;
+    bool realtime = false;
+    int realtime_cpu = -1;
 
     static struct option long_options[] = {
             {"help",        no_argument,       0,           'h'},
@@ -124,6 +125,16 @@ int main(int argc, char *argv[])
             {"program-only",no_argument,       &flags.program_only, 1},
             {"eeprom-only", no_argument,       &flags.eeprom_only,  1},
 	    {"fulldump",    no_argument,       &flags.fulldump,     1},
+            {"train",       no_argument,       &flags.train,        1},
+            {"no-image-cache", no_argument,    &flags.no_image_cache, 1},
+            {"sleep-threshold", required_argument, 0,     OPT_SLEEP_THRESHOLD},
+            {"gpiochip",    required_argument, 0,           OPT_GPIOCHIP},
+            {"realtime",    optional_argument, 0,           OPT_REALTIME},
+            {"hex-record-size", required_argument, 0,     OPT_HEX_RECORD_SIZE},
+            {"overlap",     required_argument, 0,           OPT_OVERLAP},
+            {"verify-region", required_argument, 0,       OPT_VERIFY_REGION},
+            {"incremental", no_argument,       &flags.incremental,  1},
+            {"pe-4phase",   no_argument,       &flags.pe_4phase,    1},
             {0, 0, 0, 0}
     };
 
@@ -184,6 +195,45 @@ int main(int argc, char *argv[])
                 function = FXN_WRITE_UID;
 				userid = std::stoull(optarg, nullptr, 16);
                 break;
+            case OPT_SLEEP_THRESHOLD:
+                delay_set_sleep_threshold(atoi(optarg));
+                break;
+            case OPT_GPIOCHIP:
+                gpiochip = optarg;
+                break;
+            case OPT_REALTIME:
+                realtime = true;
+                if(optarg) realtime_cpu = atoi(optarg);
+                break;
+            case OPT_HEX_RECORD_SIZE:
+                inhx_record_size = atoi(optarg);
+                if(inhx_record_size < 2 || inhx_record_size > 255){
+                    cout << "Hex record size must be between 2 and 255 bytes!" << endl;
+                    exit(1);
+                }
+                break;
+            case OPT_OVERLAP:
+                if(strcmp(optarg, "error") == 0)
+                    inhx_overlap = INHX_OVERLAP_ERROR;
+                else if(strcmp(optarg, "first") == 0)
+                    inhx_overlap = INHX_OVERLAP_FIRST;
+                else if(strcmp(optarg, "last") == 0)
+                    inhx_overlap = INHX_OVERLAP_LAST;
+                else{
+                    cout << "Overlap policy must be error, first or last!" << endl;
+                    exit(1);
+                }
+                break;
+            case OPT_VERIFY_REGION:
+                errno = 0;
+                region = strtoul(optarg, &end, 0);
+                if(errno || end == optarg || *end || region == 0 ||
+                        region % 0x400 || region > INT_MAX){
+                    cout << "Verify region must be a non-zero multiple of 1024 bytes!" << endl;
+                    exit(1);
+                }
+                flags.verify_region = region;
+                break;
             default:
                 cout << endl;
                 usage();
@@ -211,37 +261,65 @@ int main(int argc, char *argv[])
 
     /* Configure GPIOs */
     if(pins != 0){       // if GPIO connections are specified in the options...
-        if(!strchr(&pins[0],':'))   // port not specified
-            sscanf(&pins[0], "%d,%d,%d", &pic_clk, &pic_data, &pic_mclr);
+        if(strchr(&pins[0],'+')){   // gang mode, PGD1+PGD2+...
+            char pgd_list[128];
+
+            if(sscanf(&pins[0], "%d,%127[0-9+],%d", &pic_clk.num, pgd_list,
+                      &pic_mclr.num) != 3 || !gang_parse(pgd_list, pic_data)
+                      || gpiochip){
+                cout << "Gang mode needs -g PGC,PGD1+PGD2+...,MCLR "
+                        "with direct GPIO access!" << endl;
+                exit(1);
+            }
+        }
+        else if(!strchr(&pins[0],':'))   // port not specified
+            sscanf(&pins[0], "%d,%d,%d", &pic_clk.num, &pic_data.num,
+                   &pic_mclr.num);
         else{                       // port specified
             if(!sscanf(&pins[0],
                     "%[A-Z]:%d,%[A-Z]:%d,%[A-Z]:%d",
-                    &pic_clk_port, &pic_clk,
-                    &pic_data_port, &pic_data,
-                    &pic_mclr_port, &pic_mclr)){
+                    &pic_clk_port, &pic_clk.num,
+                    &pic_data_port, &pic_data.num,
+                    &pic_mclr_port, &pic_mclr.num)){
                         cout << "GPIO selection string not correctly formatted!"
                              << endl;
                         exit(0);
                     }
-            pic_clk |= ((pic_clk_port-'A')*PORTOFFSET)<<8;
-            pic_data |= ((pic_data_port-'A')*PORTOFFSET)<<8;
-            pic_mclr |= ((pic_mclr_port-'A')*PORTOFFSET)<<8;
+            pic_clk.num |= ((pic_clk_port-'A')*PORTOFFSET)<<8;
+            pic_data.num |= ((pic_data_port-'A')*PORTOFFSET)<<8;
+            pic_mclr.num |= ((pic_mclr_port-'A')*PORTOFFSET)<<8;
         }
     }
-    
+
+    /* with a gpiochip, pins are line offsets on it */
+    if(gpiochip){
+        pic_clk.num = gpio_cdev::line_offset(pic_clk.num);
+        pic_data.num = gpio_cdev::line_offset(pic_data.num);
+        pic_mclr.num = gpio_cdev::line_offset(pic_mclr.num);
+        pic_clk_port = pic_data_port = pic_mclr_port = 0;
+    }
+
     if(flags.debug){
-        cout << "PGC <=> pin " << pic_clk_port << (pic_clk&0xFF)
+        cout << "PGC <=> pin " << pic_clk_port << (pic_clk.num&0xFF)
              << endl;
-        cout << "PGD <=> pin " << pic_data_port << (pic_data&0xFF)
+        cout << "PGD <=> pin " << pic_data_port << (pic_data.num&0xFF)
              << endl;
-        cout << "MCLR <=> pin " << pic_mclr_port << (pic_mclr&0xFF)
+        if(gang_targets() > 1)
+            cout << "(" << gang_targets() << " targets in gang mode)" << endl;
+        cout << "MCLR <=> pin " << pic_mclr_port << (pic_mclr.num&0xFF)
              << endl;
     }
 
+    /* Calibrate the delay loops */
+    delay_init();
+
     /* Setup gpio pointer for direct register access */
     if(flags.debug) cout << "Setting up I/O..." << endl;
     setup_io();
 
+    /* Lock memory, pin to a CPU and switch to SCHED_FIFO */
+    if(realtime) realtime_enter(realtime_cpu);
+
     if(function == FXN_RESET)
         pic_reset();
     else if(function == FXN_SERVER)
@@ -318,6 +396,8 @@ int main(int argc, char *argv[])
         /* ENTER PROGRAM MODE */
         pic -> enter_program_mode();
         pic -> setup_pe();
+        if(flags.train)
+            link_train(pic, family ? family : "dspic33f");
 
         if(pic -> read_device_id()){  // Read devide ID and setup memory
         
@@ -325,13 +405,20 @@ int main(int argc, char *argv[])
 		    fprintf(stdout,"Device ID: 0x%08x\n", pic->device_id);
             fprintf(stderr,"Revision: 0x%08x\n", pic->device_rev);
 
+            delay_stats_reset();
+            gang_reset();
+
             switch (function){
                 case FXN_NULL:          // no function selected, exit
                     break;
                 case FXN_READ:
                     cout << "Reading chip...";
-                    pic->read(outfile,start,count);
-                    cout << "DONE! " << endl;
+                    if(pic->read(outfile,start,count))
+                        cout << "DONE! " << endl;
+                    else{
+                        cout << "FAILED!" << endl;
+                        status = 1;
+                    }
                     break;
                 case FXN_WRITE:
                     cout << "Writing chip...";
@@ -353,7 +440,9 @@ int main(int argc, char *argv[])
                 case FXN_BLANKCHEK:
                     cout << "Blank check...";
                     retval = pic->blank_check();
-                    if(retval == 0)
+                    if(gang_targets() > 1)  // per target, see gang_report()
+                        cout << "DONE!" << endl;
+                    else if(retval == 0)
                         cout << "chip is blank." << endl;
                     else
                         cout << "chip is not blank." << endl;
@@ -376,6 +465,12 @@ int main(int argc, char *argv[])
                     "between -d, -b, -r, -w, -e." << endl;
                     break;
             };
+
+            if(gang_targets() > 1)
+                gang_report();
+
+            if(flags.debug || realtime)
+                delay_stats_report();
         }
         else{
 		    fprintf(stdout,"Device ID: 0x%x\n", pic ->device_id);
@@ -387,8 +482,7 @@ int main(int argc, char *argv[])
         pic->exit_program_mode();
 
         /* Free memory */
-        free(pic->mem.location);
-        free(pic->mem.filled);
+        pic->mem.clear();
     }
 
 clean:
@@ -397,30 +491,45 @@ clean:
 
     fclose(stderr);
     fclose(stdout);
-    return 0;
+    return status;
 }
 
 /* Set up a memory regions to access GPIO */
 void setup_io(void)
 {
-    /* open /dev/mem */
-    mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
-    if (mem_fd == -1) {
-        perror("Cannot open /dev/mem");
-        exit(1);
+    if(gpiochip){
+        /* request the lines from the GPIO character device */
+        if(!gpio_cdev::open(gpiochip, pic_clk.num, pic_data.num,
+                             pic_mclr.num))
+            exit(1);
     }
+    else{
+        /* open /dev/mem */
+        mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
+        if (mem_fd == -1) {
+            perror("Cannot open /dev/mem");
+            exit(1);
+        }
 
-    /* mmap GPIO */
-    gpio_map = mmap(0, BLOCK_SIZE, PROT_READ|PROT_WRITE,
-                    MAP_SHARED, mem_fd, GPIO_BASE);
-    if (gpio_map == MAP_FAILED) {
-        perror("mmap() failed");
-        exit(1);
+        /* mmap GPIO */
+        gpio_map = mmap(0, BLOCK_SIZE, PROT_READ|PROT_WRITE,
+                        MAP_SHARED, mem_fd, GPIO_BASE);
+        if (gpio_map == MAP_FAILED) {
+            perror("mmap() failed");
+            exit(1);
+        }
+
+        /* Always use volatile pointer! */
+        gpio = (volatile uint32_t *) gpio_map;
+        gpio_shadow_reset();
     }
 
-    /* Always use volatile pointer! */
-    gpio = (volatile uint32_t *) gpio_map;
-        
+    /* resolve the pins once, the drivers only use their descriptors */
+    gpio_backend::resolve(pic_clk);
+    gpio_backend::resolve(pic_data);
+    gpio_backend::resolve(pic_mclr);
+    gang_resolve(pic_data);
+
     GPIO_IN(pic_clk);   // NOTE: MUST use GPIO_IN before GPIO_OUT
     GPIO_OUT(pic_clk);
     
@@ -443,6 +552,11 @@ void close_io(void)
         /* MCLR as input, puts the output driver in Hi-Z */
         GPIO_IN(pic_mclr);
 
+        if(gpiochip){
+            gpio_cdev::close();
+            return;
+        }
+
         /* munmap GPIO */
         ret = munmap(gpio_map, BLOCK_SIZE);
         if (ret == -1) {
@@ -485,9 +599,11 @@ void usage(void)
             "       --server=port,      -S port           server mode, listening on given port\n"
             "       --log=[file],       -l [file]         redirect the output to log file(s)\n"
             "       --gpio=PGC,PGD,MCLR -g PGC,PGD,MCLR   GPIO selection in form [PORT:]NUM (optional)\n"
+            "                                             PGD1+PGD2+... programs several targets at once (RPi)\n"
             "       --family=[family],  -f [family]       PIC family [default: dspic33f]\n"
             "       --read=[file.hex],  -r [file.hex]     read chip to file [defaults to ofile.hex]\n"
             "       --write=file.hex,   -w file.hex       bulk erase and write chip\n"
+            "                                             (file1.hex,file2.hex,... merges several files)\n"
             "       --erase,            -e                bulk erase chip\n"
             "       --blankcheck,       -b                blank check of the chip\n"
             "       --regdump,          -d                read configuration registers\n"
@@ -498,7 +614,26 @@ void usage(void)
             "       --fulldump                            don't detect empty sections, make complete dump (PIC32)\n"
             "       --program-only                        read/write only program section (PIC32)\n"
             "       --boot-only                           read/write only boot section (PIC32)\n"
+            "       --verify-region=bytes                 verify by CRC in regions of bytes (whole erase pages),\n"
+            "                                             then by page in the failing ones (PIC32) [default: 65536]\n"
+            "       --incremental                         with --write, erase and program only the pages\n"
+            "                                             that differ from the file, by CRC (PIC32)\n"
+            "       --pe-4phase                           send all the fast data words to the PE with 4-phase\n"
+            "                                             transfers, not only the first of each row (PIC32)\n"
             "       --eeprom-only                         read/write only eeprom (PIC18FxxKxx)\n"
+            "       --sleep-threshold=us                  sleep instead of spinning for waits longer than us\n"
+            "                                             [default: 1000, 0 = always spin]\n"
+            "       --gpiochip=/dev/gpiochipN             use the GPIO character device instead of /dev/mem\n"
+            "                                             (-g then takes line offsets on that chip)\n"
+            "       --train                               find (or reuse) the fastest reliable bit timing\n"
+            "                                             (PGC/PGD bit times only, other delays stay nominal)\n"
+            "       --realtime[=cpu]                      lock memory, run with SCHED_FIFO pinned to cpu\n"
+            "                                             [default: last cpu] and report edge jitter\n"
+            "       --hex-record-size=bytes               data bytes per record in files saved by --read [default: 16]\n"
+            "       --overlap=policy                      data given by more than one --write file:\n"
+            "                                             error, first or last file wins [default: error]\n"
+            "       --no-image-cache                      always parse the file given to --write, don't use\n"
+            "                                             or update the cache in /var/cache/picberry\n"
             "\n"
             "\n"
             "   Runtime Options\n"
@@ -718,8 +853,10 @@ void server_mode(int port){
                 case SRV_READ:
                     if(program_mode){
                         cerr << "[CMD] Read" << endl;
-                        pic->read((char *)"/var/tmp/tmpr.hex", 0, 0);
-                        send_file((char *)"/var/tmp/tmpr.hex");
+                        if(pic->read((char *)"/var/tmp/tmpr.hex", 0, 0))
+                            send_file((char *)"/var/tmp/tmpr.hex");
+                        else
+                            fprintf(stdout, "@ERR");
                     }
                     break;
                 case SRV_WRITE:
@@ -0,0 +1,124 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <iostream>
+
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Real-time mode: the bit-banging loops assume they are not preempted, as
+ * some ICSP timings have a maximum (e.g. P9b on dsPIC33F). Memory is
+ * locked (current and future allocations, so the image buffers are
+ * faulted in when allocated), the process is pinned to one CPU and raised
+ * to SCHED_FIFO. The delays then record the gaps between consecutive
+ * edges, reported at the end of each operation.
+ */
+#define RT_PRIORITY		50
+#define RT_STACK_PREFAULT	(64*1024)
+
+static bool rt_active = false;
+static cpu_set_t rt_saved_affinity;		// CPUs allowed before pinning
+
+static void prefault_stack(void)
+{
+	volatile char stack[RT_STACK_PREFAULT];
+
+	for (unsigned int i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+/* Touch the GPIO registers used by a pin, so no fault is taken later */
+static void prefault_pin(const gpio_pin &p)
+{
+	if (gpio_cdev_active)
+		return;
+	(void)*p.dir_reg;
+	(void)*p.lev_reg;
+}
+
+/*
+ * Enter real-time mode on the given CPU (-1 = last online CPU). To be
+ * called after setup_io(). Failures are reported but not fatal.
+ */
+void realtime_enter(int cpu)
+{
+	struct sched_param param;
+	cpu_set_t set;
+
+	if (cpu < 0)
+		cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+		perror("mlockall() failed");
+	prefault_stack();
+	prefault_pin(pic_clk);
+	prefault_pin(pic_data);
+	prefault_pin(pic_mclr);
+
+	if (sched_getaffinity(0, sizeof(rt_saved_affinity),
+			&rt_saved_affinity) == -1)
+		CPU_ZERO(&rt_saved_affinity);
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) == -1)
+		perror("sched_setaffinity() failed");
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = RT_PRIORITY;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+		perror("sched_setscheduler() failed");
+
+	delay_jitter_enable(true);
+	rt_active = true;
+
+	if (flags.debug)
+		cerr << "Real-time mode: SCHED_FIFO priority " << RT_PRIORITY
+			 << " on CPU " << cpu << endl;
+}
+
+/*
+ * In real-time mode, run the calling thread (a helper of the programming
+ * one) as a normal thread on the CPUs the process was allowed before
+ * realtime_enter(), so that it does not compete with the real-time one.
+ * Without real-time mode the thread is left as it was created.
+ */
+void realtime_worker(void)
+{
+	struct sched_param param;
+
+	if (!rt_active)
+		return;
+
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+	if (CPU_COUNT(&rt_saved_affinity))
+		sched_setaffinity(0, sizeof(rt_saved_affinity), &rt_saved_affinity);
+}
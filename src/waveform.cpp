@@ -0,0 +1,194 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "common.h"
+#include "waveform.h"
+
+#define OP_WAIT	0xFF	// no pin operation, delay only
+
+/* Append an operation; its (bit-level) delay is waited after it */
+void icsp_waveform::emit(uint8_t kind, uint32_t bit_delay, int slot, int bit)
+{
+	op o;
+
+	o.kind = kind;
+	o.slot = slot;
+	o.bit = bit;
+	o.bit_delay = bit_delay;
+	o.delay = 0;
+	ops.push_back(o);
+}
+
+/* Extend the delay after the last operation */
+void icsp_waveform::wait(uint32_t delay)
+{
+	if (ops.empty())
+		emit(OP_WAIT, 0);
+	ops.back().delay += delay;
+}
+
+/* Drive PGD to level (then wait the setup time), unless it is already there */
+void icsp_waveform::data(bool level, uint32_t setup)
+{
+	if (data_level == level) {
+		if (ops.empty())
+			emit(OP_WAIT, 0);
+		ops.back().bit_delay += setup;
+		return;
+	}
+	emit(level ? OP_DATA_HI : OP_DATA_LO, setup);
+	data_level = level;
+}
+
+/* One PGC pulse: high for the first delay, then low for the second */
+void icsp_waveform::clock(uint32_t high, uint32_t low)
+{
+	emit(OP_CLK_HI, high);
+	emit(OP_CLK_LO, low);
+	clk_level = 0;
+}
+
+void icsp_waveform::six(uint32_t cmd)
+{
+	int i;
+
+	/* send the SIX = 0x0000 instruction */
+	data(0, 0);
+	for (i = 0; i < 4; i++)
+		clock(timing.p1b, timing.p1a);
+	wait(timing.p4);
+
+	/* send the 24-bit command (LSB first) */
+	for (i = 0; i < 24; i++) {
+		data((cmd >> i) & 0x00000001, timing.p1a);
+		clock(timing.p1b, 0);
+	}
+	wait(timing.p4a);
+}
+
+void icsp_waveform::six_operand(int slot)
+{
+	int i;
+
+	data(0, 0);
+	for (i = 0; i < 4; i++)
+		clock(timing.p1b, timing.p1a);
+	wait(timing.p4);
+
+	for (i = 0; i < 24; i++) {
+		emit(OP_DATA_OPERAND, timing.p1a, slot, i);
+		clock(timing.p1b, 0);
+	}
+	data_level = -1;
+	wait(timing.p4a);
+}
+
+void icsp_waveform::regout(int slot)
+{
+	int i;
+
+	data(0, 0);
+	if (clk_level != 0) {
+		emit(OP_CLK_LO, 0);
+		clk_level = 0;
+	}
+
+	/* send the REGOUT = 0x0001 instruction */
+	for (i = 0; i < 4; i++) {
+		data((0x0001 >> i) & 0x001, timing.p1a);
+		clock(timing.p1b, 0);
+	}
+	wait(timing.p4);
+
+	/* idle for 8 clock cycles, waiting for the data to be ready */
+	for (i = 0; i < 8; i++)
+		clock(timing.p1b, timing.p1a);
+	wait(timing.p5);
+
+	/* read a 16-bit data word, sampled while PGC is high */
+	emit(OP_DATA_IN, 0);
+	for (i = 0; i < 16; i++) {
+		emit(OP_CLK_HI, timing.p1b);
+		emit(OP_SAMPLE, 0, slot, i);
+		emit(OP_CLK_LO, timing.p1a);
+	}
+	wait(timing.p4a);
+	emit(OP_DATA_OUT, 0);	// PGD drives its last written level again
+
+	if (slot >= results_count)
+		results_count = slot + 1;
+}
+
+/* Replay the waveform */
+void icsp_waveform::run(const uint32_t *operands, uint16_t *results) const
+{
+	for (int i = 0; i < results_count; i++)
+		results[i] = 0;
+
+	for (const op &o : ops) {
+		switch (o.kind) {
+			case OP_DATA_HI:
+				GPIO_SET(pic_data);
+				break;
+			case OP_DATA_LO:
+				GPIO_CLR(pic_data);
+				break;
+			case OP_DATA_OPERAND:
+				if ((operands[o.slot] >> o.bit) & 0x00000001)
+					GPIO_SET(pic_data);
+				else
+					GPIO_CLR(pic_data);
+				break;
+			case OP_CLK_HI:
+				GPIO_SET(pic_clk);
+				break;
+			case OP_CLK_LO:
+				GPIO_CLR(pic_clk);
+				break;
+			case OP_DATA_IN:
+				GPIO_IN(pic_data);
+				gang_word_begin();
+				break;
+			case OP_DATA_OUT:
+				gang_word_end();
+				GPIO_OUT(pic_data);
+				break;
+			case OP_SAMPLE:
+				results[o.slot] |= (GPIO_LEV(pic_data) & 0x00000001) << o.bit;
+				break;
+		}
+		if (o.bit_delay)
+			delay_bit_ns(o.bit_delay);
+		if (o.delay)
+			delay_ns(o.delay);
+	}
+}
+
+unsigned int icsp_waveform::edges(void) const
+{
+	unsigned int n = 0;
+
+	for (const op &o : ops)
+		if (o.kind == OP_CLK_HI || o.kind == OP_CLK_LO)
+			n++;
+	return n;
+}
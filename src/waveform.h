@@ -0,0 +1,92 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAVEFORM_H_
+#define WAVEFORM_H_
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Pre-rendered ICSP waveform for the dsPIC/PIC24 SIX/REGOUT protocol.
+ *
+ * A fixed run of SIX and REGOUT commands is compiled once into a flat list
+ * of pin operations, each followed by the delay required after it: the
+ * command bits of fixed SIX instructions are resolved at compile time,
+ * writes that would not change PGC/PGD are dropped and consecutive delays
+ * are merged. run() then just streams the list. Operands that change from
+ * one run to the next (e.g. addresses) are left as numbered slots whose
+ * bits are taken from the operands array at run time, while the words
+ * clocked out by REGOUT commands are stored in the results array.
+ *
+ * Only dspic33f uses it so far (fetch and latch blocks of its memory loops);
+ * the dspic33e and pic24fj drivers still clock every command bit by bit.
+ */
+
+/* ICSP timings (in nanoseconds), named as in the programming specs */
+struct icsp_timing {
+	unsigned int p1a;	// PGC low / data setup
+	unsigned int p1b;	// PGC high
+	unsigned int p4;	// delay between the 4-bit command and the operand
+	unsigned int p4a;	// delay between the operand and the next command
+	unsigned int p5;	// delay between REGOUT idle clocks and data output
+};
+
+class icsp_waveform{
+
+	public:
+		icsp_waveform(const icsp_timing &t) : timing(t), data_level(-1),
+				clk_level(-1), results_count(0) {};
+
+		void six(uint32_t cmd);			// SIX with a fixed 24-bit command
+		void six_operand(int slot);		// SIX with operands[slot] as command
+		void regout(int slot);			// REGOUT, word stored in results[slot]
+		void nop(void) {six(0x000000);};
+
+		void run(const uint32_t *operands = 0, uint16_t *results = 0) const;
+
+		unsigned int edges(void) const;	// PGC edges in a run
+
+	private:
+		enum op_kind {
+			OP_DATA_HI, OP_DATA_LO, OP_DATA_OPERAND, OP_CLK_HI, OP_CLK_LO,
+			OP_DATA_IN, OP_DATA_OUT, OP_SAMPLE
+		};
+
+		struct op {
+			uint8_t kind;
+			uint8_t slot;		// operand/result slot (OPERAND, SAMPLE)
+			uint8_t bit;		// bit within the slot (OPERAND, SAMPLE)
+			uint32_t bit_delay;	// ns to wait after it, see delay_bit_ns()
+			uint32_t delay;		// then ns to wait at nominal length
+		};
+
+		void emit(uint8_t kind, uint32_t bit_delay, int slot = 0, int bit = 0);
+		void wait(uint32_t delay);
+		void data(bool level, uint32_t setup);
+		void clock(uint32_t high, uint32_t low);
+
+		icsp_timing timing;
+		std::vector<op> ops;
+		int data_level, clk_level;	// levels at this point, -1 if unknown
+		int results_count;
+};
+
+#endif /* WAVEFORM_H_ */
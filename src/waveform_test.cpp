@@ -0,0 +1,269 @@
+/*
+ * Raspberry Pi PIC Programmer using GPIO connector
+ * https://github.com/WallaceIT/picberry
+ * Copyright 2014 Francesco Valla
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "common.h"
+#include "waveform.h"
+
+/*
+ * Tests of the pre-rendered SIX/REGOUT waveforms (waveform.cpp) against a
+ * simulated dsPIC ICSP target (built with gpio_sim.h): the target decodes
+ * the 4-bit commands and their operands on the falling edges of PGC, runs
+ * "MOV #lit16, Wn" and "MOV Wn, VISI" and shifts VISI out on REGOUT. The
+ * PGC high and low times are checked against the waveform timing, using a
+ * simulated clock advanced by delay_ns() and delay_bit_ns(). Run with
+ * `make test`.
+ */
+
+gpio_pin pic_clk(1), pic_data(2), pic_mclr(3);
+
+static const icsp_timing timing = {80, 80, 40, 40, 20};
+
+/* simulated time, in ns, and the part of it waited at nominal length */
+static uint64_t now = 0, nominal = 0;
+
+void delay_ns(unsigned int howLong)
+{
+	now += howLong;
+	nominal += howLong;
+}
+
+void delay_bit_ns(unsigned int howLong)
+{
+	now += howLong;
+}
+
+void gang_word_begin(void)
+{
+}
+
+void gang_word_end(void)
+{
+}
+
+static struct {
+	enum {CMD, OPERAND, IDLE, OUT} state;
+	int bits;				// bits shifted in the current state
+	uint32_t shift;
+	bool clk, data, data_out, driving;
+	uint64_t edge;			// time of the last PGC edge
+	unsigned long edges;
+	unsigned long short_high, short_low, data_while_high;
+	uint16_t w[16], visi;
+	std::vector<uint32_t> six;	// SIX operands received
+	unsigned int regouts;
+} target;
+
+static void target_reset(void)
+{
+	target.state = target.CMD;
+	target.bits = 0;
+	target.shift = 0;
+	target.clk = false;
+	target.driving = false;
+	target.edge = now;
+	now += 1000;		// PGC idle before the run
+	target.edges = 0;
+	target.short_high = target.short_low = target.data_while_high = 0;
+	target.six.clear();
+	target.regouts = 0;
+}
+
+static void target_execute(uint32_t op)
+{
+	target.six.push_back(op);
+	if ((op & 0xF00000) == 0x200000)			// MOV #lit16, Wn
+		target.w[op & 0xF] = (op >> 4) & 0xFFFF;
+	else if ((op & 0xFFFFF0) == 0x883C20)	// MOV Wn, VISI
+		target.visi = target.w[op & 0xF];
+}
+
+static void target_falling(void)
+{
+	bool bit = target.data;
+
+	switch (target.state) {
+		case target.CMD:
+			target.shift |= bit << target.bits;
+			if (++target.bits < 4)
+				return;
+			target.state = target.shift == 0x1 ? target.IDLE : target.OPERAND;
+			break;
+		case target.OPERAND:
+			target.shift |= bit << target.bits;
+			if (++target.bits < 24)
+				return;
+			target_execute(target.shift);
+			target.state = target.CMD;
+			break;
+		case target.IDLE:
+			if (++target.bits < 8)
+				return;
+			target.state = target.OUT;
+			break;
+		case target.OUT:
+			if (++target.bits < 16)
+				return;
+			target.regouts++;
+			target.state = target.CMD;
+			break;
+	}
+	target.bits = 0;
+	target.shift = 0;
+}
+
+static void target_clk(bool level)
+{
+	if (level == target.clk)
+		return;
+	if (level && now - target.edge < (uint64_t)timing.p1a &&
+			now - target.edge < (uint64_t)timing.p4a)
+		target.short_low++;
+	if (!level && now - target.edge < timing.p1b)
+		target.short_high++;
+	target.clk = level;
+	target.edge = now;
+	target.edges++;
+
+	if (level && target.state == target.OUT)
+		target.data_out = (target.visi >> target.bits) & 0x1;
+	if (!level)
+		target_falling();
+}
+
+static void target_data(bool level)
+{
+	if (target.clk && target.driving && level != target.data)
+		target.data_while_high++;
+	target.data = level;
+}
+
+void gpio_sim::resolve(gpio_pin &p)
+{
+}
+
+void gpio_sim::in(const gpio_pin &p)
+{
+	if (&p == &pic_data)
+		target.driving = false;
+}
+
+void gpio_sim::out(const gpio_pin &p)
+{
+	if (&p == &pic_data)
+		target.driving = true;
+}
+
+void gpio_sim::set(const gpio_pin &p)
+{
+	if (&p == &pic_clk)
+		target_clk(true);
+	else if (&p == &pic_data)
+		target_data(true);
+}
+
+void gpio_sim::clr(const gpio_pin &p)
+{
+	if (&p == &pic_clk)
+		target_clk(false);
+	else if (&p == &pic_data)
+		target_data(false);
+}
+
+uint32_t gpio_sim::lev(const gpio_pin &p)
+{
+	return (&p == &pic_data && !target.driving) ? target.data_out : 0;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failures++;
+}
+
+/* Load W0:W5 from the operands, then read them back through VISI */
+static void test_roundtrip(void)
+{
+	icsp_waveform wave(timing);
+	std::vector<uint32_t> expected;
+	uint32_t operands[6];
+	uint16_t results[6];
+	bool ok = true;
+
+	for (int i = 0; i < 6; i++)
+		wave.six_operand(i);
+	wave.nop();
+	for (int i = 0; i < 6; i++) {
+		wave.six(0x883C20 + i);
+		wave.nop();
+		wave.nop();
+		wave.regout(i);
+		wave.nop();
+	}
+
+	for (int run = 0; run < 2; run++) {
+		expected.clear();
+		for (int i = 0; i < 6; i++) {
+			operands[i] = 0x200000 | i |
+					((0x1234*(i+1) ^ run*0xFFFF) & 0xFFFF) << 4;
+			expected.push_back(operands[i]);
+		}
+		expected.push_back(0x000000);
+		for (int i = 0; i < 6; i++) {
+			expected.push_back(0x883C20 + i);
+			expected.push_back(0x000000);
+			expected.push_back(0x000000);
+			expected.push_back(0x000000);
+		}
+
+		target_reset();
+		nominal = 0;
+		wave.run(operands, results);
+		for (int i = 0; i < 6; i++)
+			if (results[i] != ((operands[i] >> 4) & 0xFFFF))
+				ok = false;
+		check(target.six == expected, "SIX commands and operands decoded");
+		check(target.regouts == 6 && target.state == target.CMD &&
+				target.driving, "six REGOUTs, PGD driven again at the end");
+		check(ok, "REGOUT results match the values loaded");
+		check(target.edges == wave.edges(), "edges() counts the PGC edges");
+		check(!target.short_high && !target.short_low,
+				"PGC high and low times respected");
+		check(!target.data_while_high, "PGD only changed while PGC is low");
+		check(nominal == 31*(timing.p4 + timing.p4a) +
+				6*(timing.p4 + timing.p5 + timing.p4a),
+				"only P4, P4A and P5 waited at nominal length");
+	}
+}
+
+int main(void)
+{
+	test_roundtrip();
+
+	printf("%s\n", failures ? "FAILED" : "All tests passed");
+	return failures ? 1 : 0;
+}